@@ -0,0 +1,84 @@
+// Binary protocol of the prediction server (kmeans-parallel-fast --serve) and its load generator.
+// One request/response at a time per connection, native byte order (the socket is local).
+//
+// Request:  RequestHeader, then count * total_attr float64 values (ASSIGN only)
+// Response: ResponseHeader, then count int32 labels (ASSIGN) or one ServerStats (STATS)
+
+#ifndef KMEANS_ASSIGN_PROTOCOL_H
+#define KMEANS_ASSIGN_PROTOCOL_H
+
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+const uint32_t REQUEST_MAGIC = 0x51524d4b;  // "KMRQ"
+const uint32_t RESPONSE_MAGIC = 0x53524d4b; // "KMRS"
+
+enum RequestType { REQUEST_ASSIGN = 1, REQUEST_STATS = 2 };
+enum ResponseStatus { STATUS_OK = 0, STATUS_BAD_REQUEST = 1 };
+
+struct RequestHeader
+{
+	uint32_t magic;
+	uint32_t type;
+	uint32_t count;      // points in this request
+	uint32_t total_attr; // must match the model
+};
+
+struct ResponseHeader
+{
+	uint32_t magic;
+	uint32_t status;
+	uint32_t count;
+	uint32_t reserved;
+};
+
+// Server side latency = time from a request being read to its labels being ready (queueing + batched assignment)
+struct ServerStats
+{
+	uint32_t K;
+	uint32_t total_attr;  // what ASSIGN requests must send
+	uint64_t requests;
+	uint64_t points;
+	uint64_t batches;     // passes through the assignment kernel
+	double p50_us;
+	double p99_us;
+	double max_us;
+};
+
+// read()/send() until all 'size' bytes went through; false on EOF or error. A peer that hung up is an error
+// (EPIPE) and not a SIGPIPE, which would kill the whole server.
+inline bool readFull(int fd, void* buffer, size_t size)
+{
+	char* cursor = (char*)buffer;
+	while(size > 0)
+	{
+		ssize_t n = read(fd, cursor, size);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return false;
+		cursor += n;
+		size -= n;
+	}
+	return true;
+}
+
+inline bool writeFull(int fd, const void* buffer, size_t size)
+{
+	const char* cursor = (const char*)buffer;
+	while(size > 0)
+	{
+		ssize_t n = send(fd, cursor, size, MSG_NOSIGNAL);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return false;
+		cursor += n;
+		size -= n;
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,283 @@
+// Long-running nearest-centroid server over a Unix domain socket (protocol in assign-protocol.h).
+// Every connection gets a thread that reads requests and queues them; a single batcher thread drains
+// everything queued so far and runs it through the assignment kernel in one pass, so concurrent small
+// requests share one trip through findNearestCluster instead of paying for one each.
+// The server owns all its threads: the destructor hangs up on the clients and joins them before it goes.
+
+#ifndef KMEANS_ASSIGN_SERVER_H
+#define KMEANS_ASSIGN_SERVER_H
+
+#include <vector>
+#include <deque>
+#include <list>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <string.h>
+#include "assign-protocol.h"
+
+using namespace std;
+
+class AssignServer
+{
+private:
+	static const int MAX_BATCH_POINTS = 65536;
+	static const int LATENCY_WINDOW = 65536; // latest requests kept for the percentiles
+
+	struct Pending
+	{
+		const double* rows;
+		int count;
+		int* labels;
+		chrono::high_resolution_clock::time_point received;
+		bool ready;
+	};
+
+	int K, total_attr;
+	function<void(const double*, int, int*)> assign; // rows (count * total_attr) -> labels
+
+	struct Connection
+	{
+		int fd;
+		thread worker;
+		atomic<bool> finished{false};
+	};
+
+	mutex m;
+	condition_variable work_cv, done_cv;
+	deque<Pending*> queue;
+	bool stopping = false;      // batcher: drain the queue and exit
+
+	thread batcher_thread;
+	mutex connections_m;
+	list<Connection> connections;
+
+	vector<double> latencies; // ring buffer, μs
+	uint64_t requests = 0, points = 0, batches = 0;
+
+	void batcher()
+	{
+		vector<double> rows;
+		vector<int> labels;
+		vector<Pending*> batch;
+		while(true)
+		{
+			{
+				unique_lock<mutex> lock(m);
+				work_cv.wait(lock, [&] { return !queue.empty() || stopping; });
+				if(queue.empty())
+					return; // stopping
+				int batch_points = 0;
+				while(!queue.empty() && (batch.empty() || batch_points + queue.front()->count <= MAX_BATCH_POINTS))
+				{
+					batch_points += queue.front()->count;
+					batch.push_back(queue.front());
+					queue.pop_front();
+				}
+			}
+
+			if(batch.size() == 1)
+				assign(batch[0]->rows, batch[0]->count, batch[0]->labels);
+			else
+			{
+				rows.clear();
+				for(Pending* p : batch)
+					rows.insert(rows.end(), p->rows, p->rows + (size_t)p->count * total_attr);
+				labels.resize(rows.size() / total_attr);
+				assign(rows.data(), labels.size(), labels.data());
+				size_t offset = 0;
+				for(Pending* p : batch)
+				{
+					copy(labels.begin() + offset, labels.begin() + offset + p->count, p->labels);
+					offset += p->count;
+				}
+			}
+
+			auto now = chrono::high_resolution_clock::now();
+			{
+				lock_guard<mutex> lock(m);
+				for(Pending* p : batch)
+				{
+					double us = chrono::duration_cast<chrono::nanoseconds>(now - p->received).count() / 1000.0;
+					latencies[requests % LATENCY_WINDOW] = us;
+					requests++;
+					points += p->count;
+					p->ready = true;
+				}
+				batches++;
+			}
+			done_cv.notify_all();
+			batch.clear();
+		}
+	}
+
+	ServerStats getStats()
+	{
+		ServerStats stats;
+		stats.K = K;
+		stats.total_attr = total_attr;
+		vector<double> window;
+		{
+			lock_guard<mutex> lock(m);
+			stats.requests = requests;
+			stats.points = points;
+			stats.batches = batches;
+			window.assign(latencies.begin(), latencies.begin() + min<uint64_t>(requests, LATENCY_WINDOW));
+		}
+		stats.p50_us = stats.p99_us = stats.max_us = 0.0;
+		if(!window.empty())
+		{
+			sort(window.begin(), window.end());
+			stats.p50_us = window[window.size() / 2];
+			stats.p99_us = window[min(window.size() - 1, window.size() * 99 / 100)];
+			stats.max_us = window.back();
+		}
+		return stats;
+	}
+
+	void handleConnection(Connection* connection)
+	{
+		int fd = connection->fd;
+		RequestHeader request;
+		vector<double> rows;
+		vector<int> labels;
+		while(readFull(fd, &request, sizeof(request)))
+		{
+			ResponseHeader response = { RESPONSE_MAGIC, STATUS_OK, 0, 0 };
+			if(request.magic != REQUEST_MAGIC)
+				break; // lost framing, drop the connection
+
+			if(request.type == REQUEST_STATS)
+			{
+				ServerStats stats = getStats();
+				if(!writeFull(fd, &response, sizeof(response)) || !writeFull(fd, &stats, sizeof(stats)))
+					break;
+				continue;
+			}
+
+			if(request.type != REQUEST_ASSIGN || request.total_attr != (uint32_t)total_attr
+				|| request.count > (uint32_t)MAX_BATCH_POINTS)
+			{
+				// Payload size can't be trusted either, so answer and hang up
+				response.status = STATUS_BAD_REQUEST;
+				writeFull(fd, &response, sizeof(response));
+				break;
+			}
+
+			rows.resize((size_t)request.count * total_attr);
+			labels.resize(request.count);
+			if(!readFull(fd, rows.data(), rows.size() * sizeof(double)))
+				break;
+
+			Pending pending = { rows.data(), (int)request.count, labels.data(), chrono::high_resolution_clock::now(), false };
+			{
+				unique_lock<mutex> lock(m);
+				queue.push_back(&pending);
+				work_cv.notify_one();
+				done_cv.wait(lock, [&] { return pending.ready; });
+			}
+
+			response.count = request.count;
+			if(!writeFull(fd, &response, sizeof(response)) || !writeFull(fd, labels.data(), labels.size() * sizeof(int)))
+				break;
+		}
+		shutdown(fd, SHUT_RDWR); // the fd is closed when the thread is joined
+		connection->finished = true;
+	}
+
+	// Joins the connection threads that are done (all of them when hanging up first)
+	void reapConnections(bool hang_up)
+	{
+		lock_guard<mutex> lock(connections_m);
+		for(auto c = connections.begin(); c != connections.end();)
+		{
+			if(hang_up)
+				shutdown(c->fd, SHUT_RDWR); // wakes a thread blocked in readFull
+			if(!hang_up && !c->finished)
+			{
+				++c;
+				continue;
+			}
+			c->worker.join();
+			close(c->fd);
+			c = connections.erase(c);
+		}
+	}
+
+public:
+	AssignServer(int K, int total_attr, function<void(const double*, int, int*)> assign)
+	{
+		this->K = K;
+		this->total_attr = total_attr;
+		this->assign = assign;
+		latencies.resize(LATENCY_WINDOW);
+	}
+
+	AssignServer(const AssignServer&) = delete;
+	AssignServer& operator=(const AssignServer&) = delete;
+
+	~AssignServer()
+	{
+		// Connections first: they may wait for the batcher to answer their last request
+		reapConnections(true);
+		{
+			lock_guard<mutex> lock(m);
+			stopping = true;
+		}
+		work_cv.notify_one();
+		if(batcher_thread.joinable())
+			batcher_thread.join();
+	}
+
+	// Bind the socket and serve forever; returns only if the socket can't be set up
+	int serve(const string& socket_path)
+	{
+		int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if(listen_fd < 0 || socket_path.size() >= sizeof(addr.sun_path))
+		{
+			cerr << "Cannot create socket " << socket_path << endl;
+			return 1;
+		}
+		strcpy(addr.sun_path, socket_path.c_str());
+		unlink(socket_path.c_str()); // stale socket from a previous run
+		if(bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 128) < 0)
+		{
+			cerr << "Cannot listen on " << socket_path << ": " << strerror(errno) << endl;
+			return 1;
+		}
+
+		batcher_thread = thread(&AssignServer::batcher, this);
+		while(true)
+		{
+			int fd = accept(listen_fd, nullptr, nullptr);
+			if(fd < 0)
+			{
+				if(errno == EINTR)
+					continue;
+				cerr << "accept failed: " << strerror(errno) << endl;
+				close(listen_fd);
+				return 1;
+			}
+			reapConnections(false);
+			lock_guard<mutex> lock(connections_m);
+			connections.emplace_back();
+			Connection& connection = connections.back();
+			connection.fd = fd;
+			connection.worker = thread(&AssignServer::handleConnection, this, &connection);
+		}
+	}
+};
+
+#endif
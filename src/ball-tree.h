@@ -0,0 +1,223 @@
+// Ball tree over the K centroids, used to answer nearest-centroid queries when K is large.
+// The tree is rebuilt (in parallel) after every centroid update, queries are exact.
+
+#ifndef KMEANS_BALL_TREE_H
+#define KMEANS_BALL_TREE_H
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <tbb/parallel_invoke.h>
+#include <tbb/parallel_for.h>
+
+using namespace std;
+
+// Squared euclidean distance, 4 values at a time (same summation order everywhere so ties break the same way).
+// T is double in the engines; kmeans-microbench also times it on floats.
+template <class T>
+inline T squaredDistance(const T* a, const T* b, int total_attr)
+{
+	T sum = 0;
+	int j;
+	#pragma omp simd
+	for(j = 0; j + 3 < total_attr; j += 4)
+	{
+		T diff0 = a[j] - b[j];
+		T diff1 = a[j+1] - b[j+1];
+		T diff2 = a[j+2] - b[j+2];
+		T diff3 = a[j+3] - b[j+3];
+		sum += diff0 * diff0 + diff1 * diff1 + diff2 * diff2 + diff3 * diff3;
+	}
+
+	// Cleanup loop for remaining elements
+	for(; j < total_attr; j++)
+	{
+		T diff = a[j] - b[j];
+		sum += diff * diff;
+	}
+	return sum;
+}
+
+class CentroidBallTree
+{
+private:
+	static const int LEAF_SIZE = 16;        // max centroids per leaf
+	static const int PARALLEL_CUTOFF = 512; // build subtrees smaller than this serially
+
+	struct Node
+	{
+		int begin, end;   // range in order[]
+		int left, right;  // child node indexes, -1 for leaves
+		double radius;
+	};
+
+	int K, total_attr;
+	const double* centroids;   // K * total_attr, owned by KMeans
+	vector<int> order;         // permutation of centroid ids, leaves own contiguous ranges
+	vector<Node> nodes;
+	vector<double> centers;    // nodes.size() * total_attr
+
+	// Number of nodes a subtree over 'count' centroids uses (splits are always at the middle)
+	static int subtreeSize(int count)
+	{
+		if(count <= LEAF_SIZE)
+			return 1;
+		return 1 + subtreeSize(count / 2) + subtreeSize(count - count / 2);
+	}
+
+	// Build node 'id' over order[begin, end). Children positions are known up front,
+	// so both halves can be written concurrently without any locking.
+	void build(int id, int begin, int end)
+	{
+		Node& node = nodes[id];
+		node.begin = begin;
+		node.end = end;
+		node.left = node.right = -1;
+
+		double* center = &centers[(size_t)id * total_attr];
+		fill(center, center + total_attr, 0.0);
+		for(int i = begin; i < end; i++)
+		{
+			const double* c_vals = &centroids[(size_t)order[i] * total_attr];
+			for(int j = 0; j < total_attr; j++)
+				center[j] += c_vals[j];
+		}
+		for(int j = 0; j < total_attr; j++)
+			center[j] /= (end - begin);
+
+		double max_dist = 0.0;
+		for(int i = begin; i < end; i++)
+			max_dist = max(max_dist, squaredDistance(center, &centroids[(size_t)order[i] * total_attr], total_attr));
+		node.radius = sqrt(max_dist);
+
+		if(end - begin <= LEAF_SIZE)
+			return;
+
+		// Split on the attribute with the largest spread
+		int split_attr = 0;
+		double best_spread = -1.0;
+		for(int j = 0; j < total_attr; j++)
+		{
+			double lo = centroids[(size_t)order[begin] * total_attr + j], hi = lo;
+			for(int i = begin + 1; i < end; i++)
+			{
+				double v = centroids[(size_t)order[i] * total_attr + j];
+				lo = min(lo, v);
+				hi = max(hi, v);
+			}
+			if(hi - lo > best_spread)
+			{
+				best_spread = hi - lo;
+				split_attr = j;
+			}
+		}
+
+		int mid = begin + (end - begin) / 2;
+		const double* c = centroids;
+		int D = total_attr;
+		nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+			[c, D, split_attr](int a, int b) {
+				return c[(size_t)a * D + split_attr] < c[(size_t)b * D + split_attr];
+			});
+
+		int left = id + 1;
+		int right = left + subtreeSize(mid - begin);
+		node.left = left;
+		node.right = right;
+
+		if(end - begin >= PARALLEL_CUTOFF)
+			tbb::parallel_invoke([&] { build(left, begin, mid); }, [&] { build(right, mid, end); });
+		else
+		{
+			build(left, begin, mid);
+			build(right, mid, end);
+		}
+	}
+
+	void search(int id, const double* p_vals, double& min_dist, int& id_cluster_center) const
+	{
+		const Node& node = nodes[id];
+		if(node.left == -1)
+		{
+			for(int i = node.begin; i < node.end; i++)
+			{
+				int c_id = order[i];
+				double dist = squaredDistance(&centroids[(size_t)c_id * total_attr], p_vals, total_attr);
+				// Lower id wins ties, matching the linear scan
+				if(dist < min_dist || (dist == min_dist && c_id < id_cluster_center))
+				{
+					min_dist = dist;
+					id_cluster_center = c_id;
+				}
+			}
+			return;
+		}
+
+		// Visit the closer child first so the far one is more likely to get pruned
+		double dist_left = sqrt(squaredDistance(&centers[(size_t)node.left * total_attr], p_vals, total_attr));
+		double dist_right = sqrt(squaredDistance(&centers[(size_t)node.right * total_attr], p_vals, total_attr));
+		int first = node.left, second = node.right;
+		double bound_first = dist_left - nodes[node.left].radius;
+		double bound_second = dist_right - nodes[node.right].radius;
+		if(dist_right < dist_left)
+		{
+			swap(first, second);
+			swap(bound_first, bound_second);
+		}
+
+		if(!canPrune(bound_first, min_dist))
+			search(first, p_vals, min_dist, id_cluster_center);
+		if(!canPrune(bound_second, min_dist))
+			search(second, p_vals, min_dist, id_cluster_center);
+	}
+
+	// A ball can be skipped when even its closest possible centroid is strictly farther than the best so far.
+	// The slack keeps rounding in the bound from ever pruning an exact tie.
+	static bool canPrune(double lower_bound, double min_dist)
+	{
+		if(lower_bound <= 0.0)
+			return false;
+		double best = sqrt(min_dist);
+		return lower_bound > best + 1e-9 * (best + lower_bound);
+	}
+
+public:
+	CentroidBallTree()
+	{
+		K = total_attr = 0;
+		centroids = nullptr;
+	}
+
+	// Payload bytes of the index over K centroids (the shape only depends on K)
+	static size_t memoryBytes(int K, int total_attr)
+	{
+		size_t total_nodes = K > 0 ? subtreeSize(K) : 0;
+		return (size_t)K * sizeof(int) + total_nodes * (sizeof(Node) + total_attr * sizeof(double));
+	}
+
+	// Rebuild over the current centroid values
+	void build(const double* centroids, int K, int total_attr)
+	{
+		this->centroids = centroids;
+		this->K = K;
+		this->total_attr = total_attr;
+
+		order.resize(K);
+		for(int i = 0; i < K; i++)
+			order[i] = i;
+		nodes.resize(subtreeSize(K));
+		centers.resize(nodes.size() * total_attr);
+		build(0, 0, K);
+	}
+
+	// Exact nearest centroid (lowest id on ties); min_dist receives the squared distance
+	int findNearest(const double* p_vals, double& min_dist) const
+	{
+		min_dist = INFINITY;
+		int id_cluster_center = K;
+		search(0, p_vals, min_dist, id_cluster_center);
+		return id_cluster_center;
+	}
+};
+
+#endif
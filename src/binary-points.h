@@ -0,0 +1,59 @@
+// Binary dataset format (written by kmeans-generate --format=binary, read by kmeans-parallel-fast and
+// kmeans-bench next to the text format). Loading skips number parsing entirely.
+//
+// Layout (native little-endian):
+//   char[4]  magic "KMPT"
+//   uint32   version (1)
+//   uint64   total_points
+//   uint32   total_attr
+//   uint32   K
+//   uint32   max_iterations
+//   uint32   reserved (0)
+//   total_points * total_attr float64 values, row major, no names
+
+#ifndef KMEANS_BINARY_POINTS_H
+#define KMEANS_BINARY_POINTS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <istream>
+
+const uint32_t POINTS_VERSION = 1;
+
+struct BinaryPointsHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t total_points;
+	uint32_t total_attr;
+	uint32_t K;
+	uint32_t max_iterations;
+	uint32_t reserved;
+};
+
+inline BinaryPointsHeader makeBinaryPointsHeader(uint64_t total_points, int total_attr, int K, int max_iterations)
+{
+	BinaryPointsHeader header;
+	memcpy(header.magic, "KMPT", 4);
+	header.version = POINTS_VERSION;
+	header.total_points = total_points;
+	header.total_attr = total_attr;
+	header.K = K;
+	header.max_iterations = max_iterations;
+	header.reserved = 0;
+	return header;
+}
+
+// Text datasets start with a digit (or a BOM), binary ones with the magic
+inline bool isBinaryPoints(std::istream& in)
+{
+	return in.peek() == 'K';
+}
+
+inline bool readBinaryPointsHeader(std::istream& in, BinaryPointsHeader& header)
+{
+	return in.read((char*)&header, sizeof(header)) && memcmp(header.magic, "KMPT", 4) == 0
+		&& header.version == POINTS_VERSION;
+}
+
+#endif
@@ -0,0 +1,197 @@
+// Merge-reduce coreset for single pass clustering of an unbounded stream.
+// Buckets of bucket_size weighted points are inserted at level 0. Two coresets on the same level are merged
+// and reduced back to bucket_size points, which moves the result one level up (like carrying in a binary
+// counter), so only O(bucket_size * levels) points are ever held. Levels are capped at MAX_LEVELS; past that
+// the top level absorbs everything, so memory stays fixed no matter how long the stream is.
+
+#ifndef KMEANS_CORESET_H
+#define KMEANS_CORESET_H
+
+#include <vector>
+#include <random>
+#include <math.h>
+#include <tbb/parallel_for.h>
+#include <tbb/enumerable_thread_specific.h>
+#include "ball-tree.h" // squaredDistance
+
+using namespace std;
+
+template <class PointT>
+class MergeReduceCoreset
+{
+private:
+	static const int MAX_LEVELS = 24;
+
+	int total_attr, bucket_size;
+	vector<vector<PointT>> levels;
+	mt19937 gen;
+	long long points_seen;
+	size_t peak_points;
+
+	// Shrink 'points' to bucket_size weighted representatives: weighted D^2 (k-means++) sampling picks the
+	// representatives, then each one moves to the weighted mean of the points closest to it and takes their weight.
+	vector<PointT> reduce(vector<PointT>& points)
+	{
+		int n = points.size();
+		if(n <= bucket_size)
+			return points;
+
+		vector<double> min_dist(n, INFINITY);
+		vector<int> nearest(n, 0);
+		vector<int> chosen;
+		chosen.reserve(bucket_size);
+
+		uniform_real_distribution<double> uniform(0.0, 1.0);
+		double total_weight = 0.0;
+		for(auto& p : points)
+			total_weight += p.getWeight();
+
+		// First representative proportional to weight
+		double target = uniform(gen) * total_weight;
+		int first = 0;
+		for(double acc = 0.0; first < n - 1; first++)
+		{
+			acc += points[first].getWeight();
+			if(acc > target)
+				break;
+		}
+		chosen.push_back(first);
+
+		while((int)chosen.size() < bucket_size)
+		{
+			int r = chosen.size() - 1;
+			const double* c_vals = points[chosen[r]].getValues().data();
+			tbb::parallel_for(0, n, 1, [&](int i) {
+				double dist = squaredDistance(c_vals, points[i].getValues().data(), total_attr);
+				if(dist < min_dist[i])
+				{
+					min_dist[i] = dist;
+					nearest[i] = r;
+				}
+			});
+
+			double total = 0.0;
+			for(int i = 0; i < n; i++)
+				total += points[i].getWeight() * min_dist[i];
+			if(total <= 0.0)
+				break; // everything left is a copy of a representative
+
+			target = uniform(gen) * total;
+			int next = 0;
+			for(double acc = 0.0; next < n - 1; next++)
+			{
+				acc += points[next].getWeight() * min_dist[next];
+				if(acc > target)
+					break;
+			}
+			chosen.push_back(next);
+		}
+
+		// Final assignment against the last representative
+		int r = chosen.size() - 1;
+		const double* c_vals = points[chosen[r]].getValues().data();
+		tbb::parallel_for(0, n, 1, [&](int i) {
+			if(squaredDistance(c_vals, points[i].getValues().data(), total_attr) < min_dist[i])
+				nearest[i] = r;
+		});
+
+		int total_chosen = chosen.size();
+		vector<double> sums((size_t)total_chosen * total_attr, 0.0);
+		vector<long long> weights(total_chosen, 0);
+		for(int i = 0; i < n; i++)
+		{
+			double w = points[i].getWeight();
+			double* p_vals = points[i].getValues().data();
+			double* s = &sums[(size_t)nearest[i] * total_attr];
+			for(int j = 0; j < total_attr; j++)
+				s[j] += w * p_vals[j];
+			weights[nearest[i]] += points[i].getWeight();
+		}
+
+		vector<PointT> reduced;
+		reduced.reserve(total_chosen);
+		vector<double> values(total_attr);
+		for(int c = 0; c < total_chosen; c++)
+		{
+			for(int j = 0; j < total_attr; j++)
+				values[j] = sums[(size_t)c * total_attr + j] / weights[c];
+			reduced.push_back(PointT(c, values));
+			reduced.back().setWeight(weights[c]);
+		}
+		return reduced;
+	}
+
+	size_t heldPoints()
+	{
+		size_t held = 0;
+		for(auto& level : levels)
+			held += level.size();
+		return held;
+	}
+
+public:
+	MergeReduceCoreset(int total_attr, int bucket_size, unsigned int seed) : gen(seed)
+	{
+		this->total_attr = total_attr;
+		this->bucket_size = bucket_size;
+		points_seen = 0;
+		peak_points = 0;
+	}
+
+	// Add one bucket (at most bucket_size points) of the stream
+	void insert(vector<PointT>& bucket)
+	{
+		for(auto& p : bucket)
+			points_seen += p.getWeight();
+
+		vector<PointT> carry = reduce(bucket);
+		for(int level = 0; ; level++)
+		{
+			if(level == (int)levels.size())
+				levels.emplace_back();
+			if(levels[level].empty())
+			{
+				levels[level].swap(carry);
+				break;
+			}
+
+			// Merge with the coreset already at this level
+			carry.insert(carry.end(), levels[level].begin(), levels[level].end());
+			peak_points = max(peak_points, heldPoints() + carry.size());
+			levels[level].clear();
+			carry = reduce(carry);
+			if(level == MAX_LEVELS - 1)
+			{
+				levels[level].swap(carry);
+				break;
+			}
+		}
+		peak_points = max(peak_points, heldPoints());
+	}
+
+	// Union of all levels: what the final clustering runs on
+	vector<PointT> getCoreset()
+	{
+		vector<PointT> coreset;
+		for(auto& level : levels)
+			coreset.insert(coreset.end(), level.begin(), level.end());
+		return coreset;
+	}
+
+	long long getPointsSeen()
+	{
+		return points_seen;
+	}
+
+	int getLevels()
+	{
+		return levels.size();
+	}
+
+	size_t getPeakPoints()
+	{
+		return peak_points;
+	}
+};
+
+#endif
@@ -0,0 +1,172 @@
+// Distance policies for KMeans<Metric>. Each one brings its own kernel (picked at compile time, so the
+// assignment loop has no per-distance switch) plus the hooks the Lloyd update needs:
+//   distance(a, b, n)        smaller = closer
+//   prepare(values, n)       applied once to every point before clustering (if PREPARES_POINTS)
+//   finishCentroid(c, n)     applied to every centroid after the mean update
+//   MEDIAN_UPDATE            centroids are per-attribute (weighted) medians instead of means
+//   EUCLIDEAN                the ball tree / PQ / quantized engines assume squared L2 and are only used then
+
+#ifndef KMEANS_DISTANCE_METRICS_H
+#define KMEANS_DISTANCE_METRICS_H
+
+#include <math.h>
+#include "ball-tree.h" // squaredDistance
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#ifdef __AVX2__
+inline double horizontalSum(__m256d v)
+{
+	__m128d sum = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+	return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+}
+#endif
+
+inline double dotProduct(const double* a, const double* b, int total_attr)
+{
+	int j = 0;
+	double sum = 0.0;
+#ifdef __AVX2__
+	__m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+	for(; j + 8 <= total_attr; j += 8)
+	{
+		acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a + j), _mm256_loadu_pd(b + j)));
+		acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(a + j + 4), _mm256_loadu_pd(b + j + 4)));
+	}
+	sum = horizontalSum(_mm256_add_pd(acc0, acc1));
+#endif
+	for(; j < total_attr; j++)
+		sum += a[j] * b[j];
+	return sum;
+}
+
+inline double manhattanDistance(const double* a, const double* b, int total_attr)
+{
+	int j = 0;
+	double sum = 0.0;
+#ifdef __AVX2__
+	const __m256d sign = _mm256_set1_pd(-0.0);
+	__m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+	for(; j + 8 <= total_attr; j += 8)
+	{
+		acc0 = _mm256_add_pd(acc0, _mm256_andnot_pd(sign, _mm256_sub_pd(_mm256_loadu_pd(a + j), _mm256_loadu_pd(b + j))));
+		acc1 = _mm256_add_pd(acc1, _mm256_andnot_pd(sign, _mm256_sub_pd(_mm256_loadu_pd(a + j + 4), _mm256_loadu_pd(b + j + 4))));
+	}
+	sum = horizontalSum(_mm256_add_pd(acc0, acc1));
+#endif
+	for(; j < total_attr; j++)
+		sum += fabs(a[j] - b[j]);
+	return sum;
+}
+
+inline void normalize(double* values, int total_attr)
+{
+	double norm = sqrt(dotProduct(values, values, total_attr));
+	if(norm > 0.0)
+		for(int j = 0; j < total_attr; j++)
+			values[j] /= norm;
+}
+
+// The default. Keeps the original unrolled kernel so results match the other implementations bit for bit.
+struct SquaredL2
+{
+	static const bool EUCLIDEAN = true;
+	static const bool MEDIAN_UPDATE = false;
+	static const bool PREPARES_POINTS = false;
+
+	static const char* name()
+	{
+		return "squared L2";
+	}
+
+	template <class T>
+	static inline T distance(const T* a, const T* b, int total_attr)
+	{
+		return squaredDistance(a, b, total_attr);
+	}
+
+	static inline void prepare(double*, int) {}
+	static inline void finishCentroid(double*, int) {}
+};
+
+// Spherical k-means: points and centroids are unit vectors, distance = 1 - cos
+struct Cosine
+{
+	static const bool EUCLIDEAN = false;
+	static const bool MEDIAN_UPDATE = false;
+	static const bool PREPARES_POINTS = true;
+
+	static const char* name()
+	{
+		return "cosine";
+	}
+
+	static inline double distance(const double* a, const double* b, int total_attr)
+	{
+		return 1.0 - dotProduct(a, b, total_attr);
+	}
+
+	static inline void prepare(double* values, int total_attr)
+	{
+		normalize(values, total_attr);
+	}
+
+	static inline void finishCentroid(double* centroid, int total_attr)
+	{
+		normalize(centroid, total_attr);
+	}
+};
+
+// k-medians: the median minimizes the summed L1 distance, so that's the update that goes with it
+struct L1
+{
+	static const bool EUCLIDEAN = false;
+	static const bool MEDIAN_UPDATE = true;
+	static const bool PREPARES_POINTS = false;
+
+	static const char* name()
+	{
+		return "L1 (median update)";
+	}
+
+	static inline double distance(const double* a, const double* b, int total_attr)
+	{
+		return manhattanDistance(a, b, total_attr);
+	}
+
+	static inline void prepare(double*, int) {}
+	static inline void finishCentroid(double*, int) {}
+};
+
+// Nearest of the K centroids (row major, K * total_attr) by linear scan, the first one on ties; min_dist gets the
+// metric's distance to it. KMeans' NEAREST_LINEAR engine.
+template <class Metric, class T>
+inline int linearScanNearest(const T* p_vals, const T* centroids, int K, int total_attr, T& min_dist)
+{
+	int id_cluster_center = 0;
+	min_dist = Metric::distance(&centroids[0], p_vals, total_attr);
+
+	for(int i = 1; i < K; i++)
+	{
+		T sum = Metric::distance(&centroids[(size_t)i * total_attr], p_vals, total_attr);
+		if (sum < min_dist)
+		{
+			min_dist = sum;
+			id_cluster_center = i;
+		}
+	}
+	return id_cluster_center;
+}
+
+// sums += weight * p_vals: how the assignment pass of KMeans::run adds a point to its thread local cluster sums
+template <class T>
+inline void addWeighted(double* sums, const T* p_vals, double weight, int total_attr)
+{
+	#pragma omp simd
+	for (int j = 0; j < total_attr; j++) {
+		sums[j] += weight * p_vals[j];
+	}
+}
+
+#endif
@@ -0,0 +1,121 @@
+// Per-column feature scaling (z-score or min-max), fitted from statistics gathered while the input is parsed.
+// ColumnStats is a Welford accumulator: every parsing thread keeps its own and they are merged at the end
+// (Chan et al. pairwise update), so mean/variance come out of the same single pass that reads the values.
+// FeatureScaling maps x -> (x - offset) / factor per column and back.
+
+#ifndef KMEANS_FEATURE_SCALING_H
+#define KMEANS_FEATURE_SCALING_H
+
+#include <vector>
+#include <math.h>
+
+using namespace std;
+
+enum ScalingMethod { SCALE_NONE = 0, SCALE_ZSCORE = 1, SCALE_MINMAX = 2 };
+
+struct ColumnStats
+{
+	long long count = 0;
+	vector<double> mean, m2, min_value, max_value; // m2 = sum of squared differences from the mean
+
+	ColumnStats(int total_attr = 0)
+	{
+		mean.assign(total_attr, 0.0);
+		m2.assign(total_attr, 0.0);
+		min_value.assign(total_attr, INFINITY);
+		max_value.assign(total_attr, -INFINITY);
+	}
+
+	void add(const double* values)
+	{
+		count++;
+		for(size_t j = 0; j < mean.size(); j++)
+		{
+			double delta = values[j] - mean[j];
+			mean[j] += delta / count;
+			m2[j] += delta * (values[j] - mean[j]);
+			min_value[j] = min(min_value[j], values[j]);
+			max_value[j] = max(max_value[j], values[j]);
+		}
+	}
+
+	void merge(const ColumnStats& other)
+	{
+		if(other.count == 0)
+			return;
+		if(count == 0)
+		{
+			*this = other;
+			return;
+		}
+		long long total = count + other.count;
+		for(size_t j = 0; j < mean.size(); j++)
+		{
+			double delta = other.mean[j] - mean[j];
+			mean[j] += delta * other.count / total;
+			m2[j] += other.m2[j] + delta * delta * ((double)count * other.count / total);
+			min_value[j] = min(min_value[j], other.min_value[j]);
+			max_value[j] = max(max_value[j], other.max_value[j]);
+		}
+		count = total;
+	}
+
+	double variance(int j) const
+	{
+		return count > 0 ? m2[j] / count : 0.0; // population variance
+	}
+};
+
+struct FeatureScaling
+{
+	ScalingMethod method = SCALE_NONE;
+	vector<double> offset, factor;
+
+	bool enabled() const
+	{
+		return method != SCALE_NONE;
+	}
+
+	// Constant columns get factor 1 so they map to 0 instead of NaN
+	void fit(const ColumnStats& stats, ScalingMethod method)
+	{
+		this->method = method;
+		int total_attr = stats.mean.size();
+		offset.resize(total_attr);
+		factor.resize(total_attr);
+		for(int j = 0; j < total_attr; j++)
+		{
+			if(method == SCALE_ZSCORE)
+			{
+				offset[j] = stats.mean[j];
+				factor[j] = sqrt(stats.variance(j));
+			}
+			else
+			{
+				offset[j] = stats.min_value[j];
+				factor[j] = stats.max_value[j] - stats.min_value[j];
+			}
+			if(!(factor[j] > 0.0))
+				factor[j] = 1.0;
+		}
+	}
+
+	void apply(double* values) const
+	{
+		for(size_t j = 0; j < offset.size(); j++)
+			values[j] = (values[j] - offset[j]) / factor[j];
+	}
+
+	void unapply(double* values) const
+	{
+		for(size_t j = 0; j < offset.size(); j++)
+			values[j] = values[j] * factor[j] + offset[j];
+	}
+
+	const char* name() const
+	{
+		return method == SCALE_ZSCORE ? "z-score" : method == SCALE_MINMAX ? "min-max" : "none";
+	}
+};
+
+#endif
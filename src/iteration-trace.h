@@ -0,0 +1,98 @@
+// Per-iteration instrumentation of KMeans::run (enabled with KMeans::setTrace; a null trace costs one pointer
+// check per task). Two outputs:
+//   JSON lines   one object per iteration: time spent building the centroid index, in assignment (P1),
+//                reduction of the thread local diffs/sums (P3) and centroid update (P2), points that changed
+//                cluster, largest centroid shift and the inertia of the assignment
+//   Chrome trace trace-event JSON (chrome://tracing, Perfetto) with one span per TBB task, on the row of the
+//                worker that ran it, plus the serial phases on the calling thread
+// Spans go to thread local buffers, so recording never takes a lock.
+
+#ifndef KMEANS_ITERATION_TRACE_H
+#define KMEANS_ITERATION_TRACE_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/task_arena.h>
+
+using namespace std;
+
+struct TraceSpan
+{
+	const char* name;
+	int iteration;
+	int thread;     // TBB worker slot in the arena
+	double begin_us, end_us;
+};
+
+struct IterationRecord
+{
+	int iteration;
+	double index_us, assign_us, reduce_us, update_us;
+	long long moved;
+	double max_shift;
+	double inertia;
+};
+
+class IterationTrace
+{
+private:
+	chrono::high_resolution_clock::time_point origin;
+	tbb::enumerable_thread_specific<vector<TraceSpan>> spans;
+	vector<IterationRecord> records;
+
+public:
+	IterationTrace() : origin(chrono::high_resolution_clock::now()) {}
+
+	// μs since the trace was created
+	double now() const
+	{
+		return chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - origin).count() / 1000.0;
+	}
+
+	// Span from begin_us until now, on the calling worker (the main thread outside any arena shows as worker 0,
+	// the slot it takes when it joins one). Returns the end time.
+	double span(const char* name, int iteration, double begin_us)
+	{
+		double end_us = now();
+		spans.local().push_back({ name, iteration, max(tbb::this_task_arena::current_thread_index(), 0), begin_us, end_us });
+		return end_us;
+	}
+
+	void addIteration(const IterationRecord& record)
+	{
+		records.push_back(record);
+	}
+
+	bool writeJsonLines(const string& path) const
+	{
+		ofstream out(path);
+		for(auto& r : records)
+			out << "{\"iteration\": " << r.iteration << ", \"index_us\": " << r.index_us << ", \"assign_us\": " << r.assign_us
+				<< ", \"reduce_us\": " << r.reduce_us << ", \"update_us\": " << r.update_us << ", \"moved\": " << r.moved
+				<< ", \"max_shift\": " << r.max_shift << ", \"inertia\": " << r.inertia << "}\n";
+		return (bool)out;
+	}
+
+	bool writeChromeTrace(const string& path) const
+	{
+		vector<TraceSpan> all;
+		for(auto& local : spans)
+			all.insert(all.end(), local.begin(), local.end());
+		sort(all.begin(), all.end(), [](const TraceSpan& a, const TraceSpan& b) { return a.begin_us < b.begin_us; });
+
+		ofstream out(path);
+		out << "{\"traceEvents\": [\n";
+		for(size_t s = 0; s < all.size(); s++)
+			out << "  {\"name\": \"" << all[s].name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << all[s].thread
+				<< ", \"ts\": " << all[s].begin_us << ", \"dur\": " << all[s].end_us - all[s].begin_us
+				<< ", \"args\": {\"iteration\": " << all[s].iteration << "}}" << (s + 1 < all.size() ? "," : "") << "\n";
+		out << "], \"displayTimeUnit\": \"ms\"}\n";
+		return (bool)out;
+	}
+};
+
+#endif
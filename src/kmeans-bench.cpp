@@ -0,0 +1,546 @@
+// End-to-end benchmark driver: runs the kmeans binaries over datasets x thread counts x repetitions,
+// collects what they print (load time, phase 1 = initialization, total and per-iteration time, iterations,
+// centroids), computes the final inertia of the printed centroids on the dataset itself, and writes every run
+// plus a median summary with speedup/efficiency against the serial baseline as JSON and/or CSV.
+//
+//   bin/kmeans-bench --engines=serial,parallel-fast --datasets=datasets/bean.txt --threads=1,2,4 --reps=5
+//       --json=results.json --csv=results.csv
+//
+// Parallel engines get --threads=T (tbb::global_control in the binary), serial ones run once per repetition.
+// Binary datasets (kmeans-generate --format=binary) only go to parallel-fast, the others read text.
+//
+// --validate runs the reference engine (kmeans-serial) once per dataset and every other engine once per thread
+// count instead, all from the same seed, and compares their results with the reference: centroids (relative
+// tolerance, the binaries print 6 significant digits), the labels the engines write with --labels-out,
+// iteration counts and inertia (relative). Mismatches are listed and the exit status is 1 if any engine
+// failed, so approximate engines (--engine-args="--quantize=int8", "--nearest=pq", ...) can be gated on quality:
+//
+//   bin/kmeans-bench --validate --engines=parallel-fast --engine-args="--nearest=pq" --max-label-mismatch=0.01
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <tuple>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <thread>
+#include <math.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "ball-tree.h" // squaredDistance
+#include "binary-points.h"
+
+using namespace std;
+
+struct RunResult
+{
+	string engine, dataset;
+	int threads, rep;
+	bool ok;
+	double wall_us, load_us, init_us, total_us, per_iteration_us;
+	int iterations;
+	double inertia;
+	vector<double> centroids; // as printed
+	vector<int> labels;       // as written with --labels-out (validation runs only)
+};
+
+struct Dataset
+{
+	string path;
+	bool binary = false;
+	int total_points, total_attr;
+	vector<double> values; // total_points * total_attr
+};
+
+bool loadDataset(const string& path, Dataset& dataset)
+{
+	ifstream in(path, ios::binary);
+	dataset.path = path;
+	dataset.binary = isBinaryPoints(in);
+	if(dataset.binary)
+	{
+		BinaryPointsHeader header;
+		if(!readBinaryPointsHeader(in, header))
+			return false;
+		dataset.total_points = header.total_points;
+		dataset.total_attr = header.total_attr;
+		dataset.values.resize((size_t)dataset.total_points * dataset.total_attr);
+		return (bool)in.read((char*)dataset.values.data(), dataset.values.size() * sizeof(double));
+	}
+
+	string first_line;
+	if(!getline(in, first_line))
+		return false;
+	if(first_line.size() >= 3 && first_line.compare(0, 3, "\xEF\xBB\xBF") == 0)
+		first_line.erase(0, 3);
+	stringstream ss(first_line);
+	int K, max_iterations, has_name = 0;
+	ss >> dataset.total_points >> dataset.total_attr >> K >> max_iterations >> has_name;
+	if(dataset.total_points <= 0 || dataset.total_attr <= 0)
+		return false;
+
+	dataset.values.resize((size_t)dataset.total_points * dataset.total_attr);
+	string name;
+	for(int i = 0; i < dataset.total_points; i++)
+	{
+		for(int j = 0; j < dataset.total_attr; j++)
+			if(!(in >> dataset.values[(size_t)i * dataset.total_attr + j]))
+				return false;
+		if(has_name)
+			in >> name;
+		in.ignore(numeric_limits<streamsize>::max(), '\n'); // fails at the end of a file without a final newline
+	}
+	return true;
+}
+
+// Value printed after "label = " (microseconds), or -1 if the line isn't there
+double findTime(const string& output, const string& label)
+{
+	size_t pos = output.find(label + " = ");
+	if(pos == string::npos)
+		return -1;
+	return atof(output.c_str() + pos + label.size() + 3);
+}
+
+// "Cluster i: v v v" lines
+vector<double> parseCentroids(const string& output, int total_attr)
+{
+	vector<double> centroids;
+	stringstream ss(output);
+	string line;
+	while(getline(ss, line))
+	{
+		if(line.rfind("Cluster ", 0) != 0 || line.find(':') == string::npos)
+			continue;
+		stringstream values(line.substr(line.find(':') + 1));
+		double v;
+		int count = 0;
+		while(values >> v)
+		{
+			centroids.push_back(v);
+			count++;
+		}
+		if(count != total_attr)
+			return vector<double>(); // not a full centroid (e.g. sparse summary)
+	}
+	return centroids;
+}
+
+// Nearest centroid of point i, its squared distance in min_dist
+int nearestCentroid(const Dataset& dataset, const vector<double>& centroids, int i, double& min_dist)
+{
+	int D = dataset.total_attr;
+	int K = centroids.size() / D;
+	const double* p_vals = &dataset.values[(size_t)i * D];
+	int best = 0;
+	min_dist = squaredDistance(&centroids[0], p_vals, D);
+	for(int c = 1; c < K; c++)
+	{
+		double dist = squaredDistance(&centroids[(size_t)c * D], p_vals, D);
+		if(dist < min_dist)
+		{
+			min_dist = dist;
+			best = c;
+		}
+	}
+	return best;
+}
+
+double computeInertia(const Dataset& dataset, const vector<double>& centroids)
+{
+	if(centroids.empty())
+		return -1;
+	double inertia = 0.0, min_dist;
+	for(int i = 0; i < dataset.total_points; i++)
+	{
+		nearestCentroid(dataset, centroids, i, min_dist);
+		inertia += min_dist;
+	}
+	return inertia;
+}
+
+// labels_path: have the engine write its labels there and read them back into result.labels
+RunResult runOnce(const string& bin_dir, const string& engine, const string& extra_args, const Dataset& dataset,
+	int threads, int rep, const string& labels_path = "")
+{
+	RunResult result;
+	result.engine = engine;
+	result.dataset = dataset.path;
+	result.threads = threads;
+	result.rep = rep;
+	result.ok = false;
+	result.wall_us = result.load_us = result.init_us = result.total_us = result.per_iteration_us = -1;
+	result.iterations = -1;
+	result.inertia = -1;
+	bool parallel = engine.rfind("parallel", 0) == 0;
+	string command = bin_dir + "/kmeans-" + engine + (parallel ? " --threads=" + to_string(threads) + " " + extra_args : "")
+		+ (labels_path.empty() ? "" : " --labels-out=" + labels_path) + " < " + dataset.path + " 2>&1";
+
+	auto begin = chrono::high_resolution_clock::now();
+	FILE* pipe = popen(command.c_str(), "r");
+	if(pipe == nullptr)
+		return result;
+	string output;
+	char buffer[65536];
+	size_t n;
+	while((n = fread(buffer, 1, sizeof(buffer), pipe)) > 0)
+		output.append(buffer, n);
+	int status = pclose(pipe);
+	auto end = chrono::high_resolution_clock::now();
+
+	result.wall_us = chrono::duration_cast<chrono::microseconds>(end - begin).count();
+	result.load_us = findTime(output, "LOAD TIME");
+	result.init_us = findTime(output, "TIME PHASE 1");
+	result.total_us = findTime(output, "TOTAL EXECUTION TIME");
+	result.per_iteration_us = findTime(output, "AV TIME PER ITERATION");
+	size_t pos = output.find("Break in iteration ");
+	if(pos != string::npos)
+		result.iterations = atoi(output.c_str() + pos + 19);
+	result.centroids = parseCentroids(output, dataset.total_attr);
+	result.inertia = computeInertia(dataset, result.centroids);
+	result.ok = status == 0 && result.total_us >= 0;
+	if(!labels_path.empty())
+	{
+		ifstream labels(labels_path);
+		int label;
+		while(labels >> label)
+			result.labels.push_back(label);
+		remove(labels_path.c_str());
+	}
+	if(!result.ok)
+		cerr << "Run failed: " << command << "\n" << output << endl;
+	return result;
+}
+
+double median(vector<double> values)
+{
+	if(values.empty())
+		return -1;
+	sort(values.begin(), values.end());
+	return values[values.size() / 2];
+}
+
+vector<string> splitList(const string& list)
+{
+	vector<string> items;
+	stringstream ss(list);
+	string item;
+	while(getline(ss, item, ','))
+		if(!item.empty())
+			items.push_back(item);
+	return items;
+}
+
+struct SummaryRow
+{
+	string engine, dataset;
+	int threads, runs;
+	double total_us, per_iteration_us, load_us, init_us, iterations, inertia, speedup, efficiency;
+};
+
+struct ValidationTolerance
+{
+	double centroid = 1e-4;       // relative, per value (printed with 6 significant digits)
+	double label_mismatch = 0.0;  // fraction of points assigned differently
+	double inertia = 1e-4;        // relative
+	int iterations = 0;           // allowed difference in iteration count
+};
+
+struct ValidationRow
+{
+	string engine, dataset;
+	int threads;
+	bool ran;
+	int iterations, reference_iterations;
+	int centroids_off;            // centroids with a value outside the tolerance
+	double max_centroid_diff;     // largest relative difference of any value
+	double label_mismatch;        // fraction of points
+	double inertia_diff;          // relative
+	bool passed;
+};
+
+// Engines start from the same seed, so centroid i of one run corresponds to centroid i of the other
+ValidationRow validateRun(const Dataset& dataset, const RunResult& reference, const RunResult& run,
+	const ValidationTolerance& tolerance)
+{
+	ValidationRow row = { run.engine, dataset.path, run.threads, run.ok, run.iterations, reference.iterations,
+		0, 0.0, 1.0, 0.0, false };
+	if(!run.ok || run.centroids.size() != reference.centroids.size() || run.centroids.empty()
+		|| (int)run.labels.size() != dataset.total_points)
+		return row;
+
+	int D = dataset.total_attr;
+	int K = reference.centroids.size() / D;
+	for(int c = 0; c < K; c++)
+	{
+		bool off = false;
+		for(int j = 0; j < D; j++)
+		{
+			double a = reference.centroids[(size_t)c * D + j], b = run.centroids[(size_t)c * D + j];
+			double diff = fabs(a - b) / max(1.0, max(fabs(a), fabs(b)));
+			row.max_centroid_diff = max(row.max_centroid_diff, diff);
+			off = off || diff > tolerance.centroid;
+		}
+		row.centroids_off += off;
+	}
+
+	long long mismatched = 0;
+	for(int i = 0; i < dataset.total_points; i++)
+		mismatched += reference.labels[i] != run.labels[i];
+	row.label_mismatch = (double)mismatched / dataset.total_points;
+	row.inertia_diff = reference.inertia > 0 ? fabs(run.inertia - reference.inertia) / reference.inertia : 0.0;
+	row.passed = row.centroids_off == 0 && row.label_mismatch <= tolerance.label_mismatch
+		&& row.inertia_diff <= tolerance.inertia && abs(row.iterations - row.reference_iterations) <= tolerance.iterations;
+	return row;
+}
+
+int runValidation(const string& bin_dir, const string& reference_engine, const vector<string>& engines,
+	const vector<string>& dataset_paths, const vector<int>& thread_counts, const string& extra_args,
+	const ValidationTolerance& tolerance)
+{
+	string labels_path = "/tmp/kmeans-bench-labels-" + to_string(getpid()) + ".txt";
+	vector<ValidationRow> rows;
+	for(auto& path : dataset_paths)
+	{
+		Dataset dataset;
+		if(!loadDataset(path, dataset))
+		{
+			cout << "Cannot read dataset " << path << endl;
+			return 1;
+		}
+		if(dataset.binary)
+		{
+			cerr << "Skipping " << path << " (the reference engine reads text datasets only)" << endl;
+			continue;
+		}
+		RunResult reference = runOnce(bin_dir, reference_engine, extra_args, dataset, 1, 0, labels_path);
+		if(!reference.ok || reference.centroids.empty() || (int)reference.labels.size() != dataset.total_points)
+		{
+			cout << "Reference engine " << reference_engine << " failed on " << path << endl;
+			return 1;
+		}
+		for(auto& engine : engines)
+		{
+			if(engine == reference_engine)
+				continue;
+			bool parallel = engine.rfind("parallel", 0) == 0;
+			for(int threads : parallel ? thread_counts : vector<int>{ 1 })
+			{
+				rows.push_back(validateRun(dataset, reference, runOnce(bin_dir, engine, extra_args, dataset, threads, 0, labels_path),
+					tolerance));
+				cerr << "." << flush;
+			}
+		}
+	}
+	cerr << endl;
+
+	int failed = 0;
+	cout << "ENGINE\tDATASET\tTHREADS\tITERATIONS\tREF ITERATIONS\tCENTROIDS OFF\tMAX CENTROID DIFF\tLABEL MISMATCH\tINERTIA DIFF\tRESULT\n";
+	for(auto& row : rows)
+	{
+		failed += !row.passed;
+		cout << row.engine << "\t" << row.dataset << "\t" << row.threads << "\t" << row.iterations << "\t"
+			<< row.reference_iterations << "\t" << row.centroids_off << "\t" << row.max_centroid_diff << "\t"
+			<< 100.0 * row.label_mismatch << "%\t" << row.inertia_diff << "\t"
+			<< (!row.ran ? "FAILED TO RUN" : row.passed ? "ok" : "MISMATCH") << "\n";
+	}
+	cout << "(vs " << reference_engine << ": centroid tolerance " << tolerance.centroid << " relative, label mismatch <= "
+		<< 100.0 * tolerance.label_mismatch << "%, inertia difference <= " << tolerance.inertia << " relative, iteration difference <= "
+		<< tolerance.iterations << ")\n";
+	cout << (failed == 0 ? "All engines match the reference" : to_string(failed) + " mismatching runs") << endl;
+	return failed == 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+	vector<string> engines = { "serial", "serial-fast", "serial-fast-unroll", "serial-fast-no-cluster",
+		"parallel-simple", "parallel-fast", "parallel-strided" };
+	vector<string> dataset_paths = { "datasets/bean.txt" };
+	vector<int> thread_counts;
+	int reps = 3;
+	string baseline = "serial", bin_dir = "bin", json_path, csv_path, extra_args;
+	bool validate = false;
+	string reference = "serial";
+	ValidationTolerance tolerance;
+	for(int a = 1; a < argc; a++)
+	{
+		string arg = argv[a];
+		if(arg.rfind("--engines=", 0) == 0)
+			engines = splitList(arg.substr(10));
+		else if(arg.rfind("--datasets=", 0) == 0)
+			dataset_paths = splitList(arg.substr(11));
+		else if(arg.rfind("--threads=", 0) == 0)
+			for(auto& t : splitList(arg.substr(10)))
+				thread_counts.push_back(stoi(t));
+		else if(arg.rfind("--reps=", 0) == 0)
+			reps = stoi(arg.substr(7));
+		else if(arg.rfind("--baseline=", 0) == 0)
+			baseline = arg.substr(11);
+		else if(arg.rfind("--bin=", 0) == 0)
+			bin_dir = arg.substr(6);
+		else if(arg.rfind("--json=", 0) == 0)
+			json_path = arg.substr(7);
+		else if(arg.rfind("--csv=", 0) == 0)
+			csv_path = arg.substr(6);
+		else if(arg.rfind("--engine-args=", 0) == 0)
+			extra_args = arg.substr(14);
+		else if(arg == "--validate")
+			validate = true;
+		else if(arg.rfind("--reference=", 0) == 0)
+			reference = arg.substr(12);
+		else if(arg.rfind("--tolerance=", 0) == 0)
+			tolerance.centroid = stod(arg.substr(12));
+		else if(arg.rfind("--max-label-mismatch=", 0) == 0)
+			tolerance.label_mismatch = stod(arg.substr(21));
+		else if(arg.rfind("--max-inertia-diff=", 0) == 0)
+			tolerance.inertia = stod(arg.substr(19));
+		else if(arg.rfind("--max-iteration-diff=", 0) == 0)
+			tolerance.iterations = stoi(arg.substr(21));
+		else
+		{
+			cout << "Usage: " << argv[0] << " [--engines=serial,...,parallel-fast] [--datasets=a.txt,b.txt]"
+				<< " [--threads=1,2,4 (default: 1, 2, 4, ... up to the cores)] [--reps=3] [--baseline=serial]"
+				<< " [--bin=bin] [--json=FILE] [--csv=FILE] [--engine-args=\"extra parallel engine options\"]"
+				<< "\n   or: " << argv[0] << " --validate [--reference=serial] [--tolerance=1e-4 (relative)]"
+				<< " [--max-label-mismatch=0 (fraction)] [--max-inertia-diff=1e-4 (relative)] [--max-iteration-diff=0]"
+				<< " [--engines=...] [--datasets=...]"
+				<< " [--threads=...] [--bin=bin] [--engine-args=...]" << endl;
+			return 1;
+		}
+	}
+	if(thread_counts.empty())
+	{
+		int cores = max(1u, thread::hardware_concurrency());
+		for(int t = 1; t < cores; t *= 2)
+			thread_counts.push_back(t);
+		thread_counts.push_back(cores);
+	}
+	if(validate)
+		return runValidation(bin_dir, reference, engines, dataset_paths, thread_counts, extra_args, tolerance);
+	if(find(engines.begin(), engines.end(), baseline) == engines.end())
+		engines.insert(engines.begin(), baseline); // speedups need it
+
+	vector<RunResult> runs;
+	for(auto& path : dataset_paths)
+	{
+		Dataset dataset;
+		if(!loadDataset(path, dataset))
+		{
+			cout << "Cannot read dataset " << path << endl;
+			return 1;
+		}
+		for(auto& engine : engines)
+		{
+			if(dataset.binary && engine != "parallel-fast")
+			{
+				cerr << "Skipping " << engine << " on " << path << " (only parallel-fast reads binary datasets)" << endl;
+				continue;
+			}
+			bool parallel = engine.rfind("parallel", 0) == 0;
+			vector<int> engine_threads = parallel ? thread_counts : vector<int>{ 1 };
+			for(int threads : engine_threads)
+				for(int rep = 0; rep < reps; rep++)
+				{
+					runs.push_back(runOnce(bin_dir, engine, extra_args, dataset, threads, rep));
+					cerr << "." << flush;
+				}
+		}
+	}
+	cerr << endl;
+
+	// Medians per engine / dataset / thread count
+	map<tuple<string, string, int>, vector<const RunResult*>> groups;
+	vector<tuple<string, string, int>> order;
+	for(auto& run : runs)
+	{
+		auto key = make_tuple(run.engine, run.dataset, run.threads);
+		if(groups.find(key) == groups.end())
+			order.push_back(key);
+		auto& group = groups[key];
+		if(run.ok)
+			group.push_back(&run);
+	}
+	map<string, double> baseline_total;
+	vector<SummaryRow> summary;
+	for(auto& key : order)
+	{
+		auto& group = groups[key];
+		auto field = [&](double RunResult::* member) {
+			vector<double> values;
+			for(auto run : group)
+				values.push_back(run->*member);
+			return median(values);
+		};
+		vector<double> iterations;
+		for(auto run : group)
+			iterations.push_back(run->iterations);
+		SummaryRow row = { get<0>(key), get<1>(key), get<2>(key), (int)group.size(), field(&RunResult::total_us),
+			field(&RunResult::per_iteration_us), field(&RunResult::load_us), field(&RunResult::init_us),
+			median(iterations), field(&RunResult::inertia), -1, -1 };
+		if(row.engine == baseline)
+			baseline_total[row.dataset] = row.total_us;
+		summary.push_back(row);
+	}
+	for(auto& row : summary)
+		if(baseline_total[row.dataset] > 0 && row.total_us > 0)
+		{
+			row.speedup = baseline_total[row.dataset] / row.total_us;
+			row.efficiency = row.speedup / row.threads;
+		}
+
+	cout << "ENGINE\tDATASET\tTHREADS\tRUNS\tTOTAL(μs)\tPER ITER(μs)\tLOAD(μs)\tINIT(μs)\tITERATIONS\tINERTIA\tSPEEDUP\tEFFICIENCY\n";
+	for(auto& row : summary)
+		cout << row.engine << "\t" << row.dataset << "\t" << row.threads << "\t" << row.runs << "\t" << row.total_us << "\t"
+			<< row.per_iteration_us << "\t" << row.load_us << "\t" << row.init_us << "\t" << row.iterations << "\t"
+			<< row.inertia << "\t" << row.speedup << "\t" << row.efficiency << "\n";
+	cout << "(speedup/efficiency of the median TOTAL EXECUTION TIME vs " << baseline << ", inertia of the printed centroids)" << endl;
+
+	if(!csv_path.empty())
+	{
+		ofstream csv(csv_path);
+		csv << "engine,dataset,threads,rep,ok,wall_us,load_us,init_us,total_us,per_iteration_us,iterations,inertia\n";
+		csv.precision(17);
+		for(auto& run : runs)
+			csv << run.engine << "," << run.dataset << "," << run.threads << "," << run.rep << "," << run.ok << ","
+				<< run.wall_us << "," << run.load_us << "," << run.init_us << "," << run.total_us << ","
+				<< run.per_iteration_us << "," << run.iterations << "," << run.inertia << "\n";
+		if(!csv)
+			cout << "Cannot write " << csv_path << endl;
+	}
+
+	if(!json_path.empty())
+	{
+		ofstream json(json_path);
+		json.precision(17);
+		json << "{\n  \"baseline\": \"" << baseline << "\",\n  \"runs\": [\n";
+		for(size_t r = 0; r < runs.size(); r++)
+		{
+			auto& run = runs[r];
+			json << "    {\"engine\": \"" << run.engine << "\", \"dataset\": \"" << run.dataset << "\", \"threads\": "
+				<< run.threads << ", \"rep\": " << run.rep << ", \"ok\": " << (run.ok ? "true" : "false")
+				<< ", \"wall_us\": " << run.wall_us << ", \"load_us\": " << run.load_us << ", \"init_us\": " << run.init_us
+				<< ", \"total_us\": " << run.total_us << ", \"per_iteration_us\": " << run.per_iteration_us
+				<< ", \"iterations\": " << run.iterations << ", \"inertia\": " << run.inertia << "}"
+				<< (r + 1 < runs.size() ? "," : "") << "\n";
+		}
+		json << "  ],\n  \"summary\": [\n";
+		for(size_t r = 0; r < summary.size(); r++)
+		{
+			auto& row = summary[r];
+			json << "    {\"engine\": \"" << row.engine << "\", \"dataset\": \"" << row.dataset << "\", \"threads\": "
+				<< row.threads << ", \"runs\": " << row.runs << ", \"total_us\": " << row.total_us
+				<< ", \"per_iteration_us\": " << row.per_iteration_us << ", \"load_us\": " << row.load_us
+				<< ", \"init_us\": " << row.init_us << ", \"iterations\": " << row.iterations
+				<< ", \"inertia\": " << row.inertia << ", \"speedup\": " << row.speedup
+				<< ", \"efficiency\": " << row.efficiency << "}" << (r + 1 < summary.size() ? "," : "") << "\n";
+		}
+		json << "  ]\n}\n";
+		if(!json)
+			cout << "Cannot write " << json_path << endl;
+	}
+	return 0;
+}
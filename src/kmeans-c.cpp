@@ -0,0 +1,238 @@
+// C interface of libkmeans (see kmeans-c.h): argument checks, the TBB arena of a call, the shared job scheduler
+// (kmeans-jobs.h) and the conversions between the C structs and KMeansMatrix / KMeansOptions / KMeansResult.
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <chrono>
+#include <tbb/task_arena.h>
+#include "libkmeans.h"
+#include "kmeans-jobs.h"
+#include "kmeans-c.h"
+
+using namespace std;
+
+extern "C" void kmeans_options_init(kmeans_options* options)
+{
+	options->engine = nullptr;
+	options->k = 0;
+	options->max_iterations = 100;
+	options->seed = 123;
+	options->threads = 0;
+	options->progress = nullptr;
+	options->user_data = nullptr;
+}
+
+static kmeans_status checkArguments(const kmeans_matrix* matrix, const kmeans_options* options)
+{
+	if(matrix == nullptr || options == nullptr || matrix->data == nullptr)
+		return KMEANS_INVALID_ARGUMENT;
+	size_t element_size = matrix->dtype == KMEANS_FLOAT32 ? sizeof(float) : sizeof(double);
+	if((matrix->dtype != KMEANS_FLOAT32 && matrix->dtype != KMEANS_FLOAT64) || matrix->rows <= 0 || matrix->rows > INT32_MAX
+		|| matrix->cols <= 0 || matrix->row_stride < matrix->cols * element_size || matrix->row_stride % element_size != 0)
+		return KMEANS_INVALID_ARGUMENT;
+	if(options->k <= 0 || options->k > matrix->rows || options->max_iterations <= 0 || options->threads < 0)
+		return KMEANS_INVALID_ARGUMENT;
+	return KMEANS_OK;
+}
+
+static const char* engineName(const kmeans_options* options)
+{
+	return options->engine != nullptr ? options->engine : "parallel-strided";
+}
+
+static KMeansMatrix toMatrix(const kmeans_matrix* matrix)
+{
+	KMeansMatrix rows;
+	rows.data = matrix->data;
+	rows.is_float = matrix->dtype == KMEANS_FLOAT32;
+	rows.total_points = matrix->rows;
+	rows.total_attr = matrix->cols;
+	rows.row_stride = matrix->row_stride;
+	return rows;
+}
+
+// The callback and its user data are copied, the caller's struct may be gone before a job ends
+static KMeansOptions toOptions(const kmeans_options* options)
+{
+	KMeansOptions run_options;
+	run_options.K = options->k;
+	run_options.max_iterations = options->max_iterations;
+	run_options.seed = options->seed;
+	run_options.threads = options->threads;
+	kmeans_progress_fn callback = options->progress;
+	void* user_data = options->user_data;
+	if(callback != nullptr)
+		run_options.progress = [callback, user_data](const KMeansProgress& state) {
+			kmeans_progress progress = { state.iteration, state.changed, state.inertia };
+			return callback(&progress, user_data) == 0;
+		};
+	return run_options;
+}
+
+static kmeans_status writeResult(const KMeansResult& result, bool is_float, int32_t* labels, void* centroids,
+	int32_t* iterations)
+{
+	if(labels != nullptr)
+		copy(result.labels.begin(), result.labels.end(), labels);
+	if(centroids != nullptr)
+	{
+		if(is_float)
+			for(size_t v = 0; v < result.centroids.size(); v++)
+				((float*)centroids)[v] = result.centroids[v];
+		else
+			copy(result.centroids.begin(), result.centroids.end(), (double*)centroids);
+	}
+	if(iterations != nullptr)
+		*iterations = result.iterations;
+	return result.cancelled ? KMEANS_CANCELLED : KMEANS_OK;
+}
+
+extern "C" kmeans_status kmeans_run(const kmeans_matrix* matrix, const kmeans_options* options, int32_t* labels, void* centroids,
+	int32_t* iterations)
+{
+	kmeans_status status = checkArguments(matrix, options);
+	if(status != KMEANS_OK)
+		return status;
+
+	unique_ptr<KMeansEngine> engine = makeEngine(engineName(options));
+	if(!engine)
+		return KMEANS_UNKNOWN_ENGINE;
+	if(options->progress != nullptr && !engine->reportsProgress())
+		return KMEANS_UNSUPPORTED;
+
+	KMeansMatrix rows = toMatrix(matrix);
+	KMeansOptions run_options = toOptions(options);
+	KMeansResult result;
+	try
+	{
+		tbb::task_arena arena(options->threads > 0 ? options->threads : tbb::task_arena::automatic);
+		arena.execute([&]() {
+			result = engine->runMatrix(rows, run_options);
+		});
+	}
+	catch(...) // nothing may unwind into C
+	{
+		return KMEANS_ERROR;
+	}
+	return writeResult(result, rows.is_float, labels, centroids, iterations);
+}
+
+struct kmeans_job
+{
+	KMeansFuture future;
+	bool is_float;
+};
+
+// All jobs of the process share one arena of all cores
+static KMeansScheduler& jobScheduler()
+{
+	static KMeansScheduler scheduler;
+	return scheduler;
+}
+
+extern "C" kmeans_status kmeans_submit(const kmeans_matrix* matrix, const kmeans_options* options, kmeans_job** job)
+{
+	if(job == nullptr)
+		return KMEANS_INVALID_ARGUMENT;
+	*job = nullptr;
+	kmeans_status status = checkArguments(matrix, options);
+	if(status != KMEANS_OK)
+		return status;
+
+	unique_ptr<KMeansEngine> engine = makeEngine(engineName(options));
+	if(!engine)
+		return KMEANS_UNKNOWN_ENGINE;
+	if(!engine->reportsProgress())
+		return KMEANS_UNSUPPORTED;
+
+	try
+	{
+		KMeansFuture future = jobScheduler().submit(engineName(options), toMatrix(matrix), toOptions(options));
+		*job = new kmeans_job{ future, matrix->dtype == KMEANS_FLOAT32 };
+	}
+	catch(...)
+	{
+		return KMEANS_ERROR;
+	}
+	return KMEANS_OK;
+}
+
+extern "C" int kmeans_job_wait(kmeans_job* job, int64_t timeout_ms)
+{
+	if(timeout_ms < 0)
+	{
+		job->future.wait();
+		return 1;
+	}
+	return job->future.waitFor(chrono::milliseconds(timeout_ms));
+}
+
+extern "C" void kmeans_job_progress(kmeans_job* job, kmeans_progress* progress)
+{
+	KMeansProgress state = job->future.progress();
+	*progress = { state.iteration, state.changed, state.inertia };
+}
+
+extern "C" void kmeans_job_cancel(kmeans_job* job)
+{
+	job->future.cancel();
+}
+
+extern "C" kmeans_status kmeans_job_result(kmeans_job* job, int32_t* labels, void* centroids, int32_t* iterations)
+{
+	KMeansResult result;
+	try
+	{
+		result = job->future.get();
+	}
+	catch(...)
+	{
+		return KMEANS_ERROR;
+	}
+	if(job->future.state() == JOB_CANCELLED && result.centroids.empty())
+		return KMEANS_CANCELLED; // cancelled before it started, nothing to write
+	return writeResult(result, job->is_float, labels, centroids, iterations);
+}
+
+extern "C" void kmeans_job_free(kmeans_job* job)
+{
+	if(job == nullptr)
+		return;
+	job->future.cancel(); // no-op when it is done
+	job->future.wait();
+	delete job;
+}
+
+extern "C" const char* kmeans_status_string(kmeans_status status)
+{
+	switch(status)
+	{
+		case KMEANS_OK: return "ok";
+		case KMEANS_CANCELLED: return "cancelled";
+		case KMEANS_INVALID_ARGUMENT: return "invalid argument";
+		case KMEANS_UNKNOWN_ENGINE: return "unknown engine";
+		case KMEANS_UNSUPPORTED: return "engine does not report progress";
+		case KMEANS_ERROR: return "engine error";
+	}
+	return "unknown status";
+}
+
+// Names live as long as the library
+static const vector<string>& engineNameTable()
+{
+	static const vector<string> names = engineNames();
+	return names;
+}
+
+extern "C" int kmeans_engine_count(void)
+{
+	return engineNameTable().size();
+}
+
+extern "C" const char* kmeans_engine_name(int index)
+{
+	if(index < 0 || index >= (int)engineNameTable().size())
+		return nullptr;
+	return engineNameTable()[index].c_str();
+}
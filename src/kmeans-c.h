@@ -0,0 +1,111 @@
+/* C interface of libkmeans (bin/libkmeans.so), for programs that hold their points in memory.
+ * The input matrix stays owned by the caller and is read in place by the parallel-strided engine (the default);
+ * the other engines copy it into their own point layout first. Labels and centroids are written into buffers
+ * the caller provides. Every kmeans_run call runs in its own TBB arena of options.threads threads, jobs started
+ * with kmeans_submit share one. Every engine draws from a generator of its own run, so calls from several
+ * threads at once are safe and give the results they give one at a time.
+ *
+ *   kmeans_options options;
+ *   kmeans_options_init(&options);
+ *   options.k = 8;
+ *   kmeans_matrix matrix = { rows, KMEANS_FLOAT32, n, d, d * sizeof(float) };
+ *   int status = kmeans_run(&matrix, &options, labels, centroids, &iterations);
+ */
+
+#ifndef KMEANS_C_H
+#define KMEANS_C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum
+{
+	KMEANS_OK = 0,
+	KMEANS_CANCELLED = 1,           /* the progress callback stopped the run, results are those of the last pass */
+	KMEANS_INVALID_ARGUMENT = -1,
+	KMEANS_UNKNOWN_ENGINE = -2,
+	KMEANS_UNSUPPORTED = -3,        /* progress callback given to an engine that does not report progress */
+	KMEANS_ERROR = -4               /* the engine failed (out of memory, ...) */
+} kmeans_status;
+
+typedef enum
+{
+	KMEANS_FLOAT32 = 0,
+	KMEANS_FLOAT64 = 1
+} kmeans_dtype;
+
+/* rows x cols, the cols values of a row contiguous, row_stride bytes from one row to the next */
+typedef struct
+{
+	const void* data;
+	kmeans_dtype dtype;
+	int64_t rows;
+	int32_t cols;
+	size_t row_stride;
+} kmeans_matrix;
+
+typedef struct
+{
+	int32_t iteration;
+	int64_t changed;                /* points that changed cluster in this pass */
+	double inertia;                 /* sum of squared distances to the assigned centroids */
+} kmeans_progress;
+
+/* Called after every Lloyd pass on the thread that called kmeans_run; a nonzero return stops the run */
+typedef int (*kmeans_progress_fn)(const kmeans_progress* progress, void* user_data);
+
+typedef struct
+{
+	const char* engine;             /* see kmeans_engine_name, NULL = "parallel-strided" */
+	int32_t k;
+	int32_t max_iterations;
+	uint32_t seed;
+	int32_t threads;                /* 0 = all cores */
+	kmeans_progress_fn progress;    /* optional */
+	void* user_data;
+} kmeans_options;
+
+void kmeans_options_init(kmeans_options* options);
+
+/* labels: rows int32 values (may be NULL), centroids: k x cols values of the input dtype (may be NULL),
+ * iterations: Lloyd passes done (may be NULL) */
+kmeans_status kmeans_run(const kmeans_matrix* matrix, const kmeans_options* options, int32_t* labels, void* centroids,
+	int32_t* iterations);
+
+/* Asynchronous runs (engines that report progress), all on one shared arena of all cores; options->threads is
+ * ignored. kmeans_submit returns at once; the matrix must stay valid until the job is freed. A job's progress
+ * callback runs on a library thread. Jobs run concurrently and share the cores (see kmeans-jobs.h). */
+typedef struct kmeans_job kmeans_job;
+
+kmeans_status kmeans_submit(const kmeans_matrix* matrix, const kmeans_options* options, kmeans_job** job);
+
+/* 1 when the job finished within timeout_ms (< 0: wait as long as it takes), 0 otherwise */
+int kmeans_job_wait(kmeans_job* job, int64_t timeout_ms);
+
+/* Last finished pass, iteration 0 before the first */
+void kmeans_job_progress(kmeans_job* job, kmeans_progress* progress);
+
+/* Stops the job at the next iteration boundary */
+void kmeans_job_cancel(kmeans_job* job);
+
+/* Waits for the job and writes its results like kmeans_run (KMEANS_CANCELLED with nothing written if it was
+ * cancelled before it started) */
+kmeans_status kmeans_job_result(kmeans_job* job, int32_t* labels, void* centroids, int32_t* iterations);
+
+/* Cancels the job if it is still running, waits for it and releases the handle */
+void kmeans_job_free(kmeans_job* job);
+
+const char* kmeans_status_string(kmeans_status status);
+
+int kmeans_engine_count(void);
+const char* kmeans_engine_name(int index); /* NULL out of range */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
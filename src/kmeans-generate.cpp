@@ -0,0 +1,208 @@
+// Synthetic Gaussian-blob datasets for scaling studies.
+// K centers are drawn uniformly in [-separation, separation]^D, every point picks a center uniformly and adds
+// N(0, 1) noise per attribute; a --duplicates fraction of the points are exact copies of an earlier point of the
+// same chunk (to exercise --dedupe). Output is the usual text format (header line + one point per line) or the
+// binary format of binary-points.h.
+//
+// Points are produced in chunks of CHUNK_POINTS: every chunk has its own generator seeded from (seed, chunk
+// index) and is generated + formatted in parallel, a serial in-order stage writes the chunks out, so the
+// output only depends on the seed and not on the number of threads.
+//
+//   bin/kmeans-generate --points=100000000 --attr=16 --k=64 --separation=20 --format=binary --out=big.kmpt
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <random>
+#include <charconv>
+#include <chrono>
+#include <stdint.h>
+#include <tbb/parallel_pipeline.h>
+#include <tbb/task_arena.h>
+#include "binary-points.h"
+
+using namespace std;
+
+const int CHUNK_POINTS = 65536;
+
+struct GeneratorConfig
+{
+	long long total_points = 1000000;
+	int total_attr = 8;
+	int K = 16;
+	int max_iterations = 100;
+	double separation = 10.0;
+	double duplicates = 0.0;
+	unsigned int seed = 123;
+	bool binary = false;
+};
+
+struct Chunk
+{
+	long long first_point;
+	int count;
+	vector<double> values;
+	string text;
+};
+
+void generateChunk(const GeneratorConfig& config, const vector<double>& centers, Chunk& chunk)
+{
+	int D = config.total_attr;
+	seed_seq seq{ config.seed, (unsigned int)(chunk.first_point / CHUNK_POINTS), (unsigned int)((chunk.first_point / CHUNK_POINTS) >> 32) };
+	mt19937_64 gen(seq);
+	normal_distribution<double> noise(0.0, 1.0);
+	uniform_int_distribution<int> pick_center(0, config.K - 1);
+	uniform_real_distribution<double> uniform(0.0, 1.0);
+
+	chunk.values.resize((size_t)chunk.count * D);
+	for(int i = 0; i < chunk.count; i++)
+	{
+		double* row = &chunk.values[(size_t)i * D];
+		if(i > 0 && uniform(gen) < config.duplicates)
+		{
+			int original = uniform_int_distribution<int>(0, i - 1)(gen);
+			copy(&chunk.values[(size_t)original * D], &chunk.values[(size_t)original * D] + D, row);
+			continue;
+		}
+		const double* center = &centers[(size_t)pick_center(gen) * D];
+		for(int j = 0; j < D; j++)
+			row[j] = center[j] + noise(gen);
+	}
+
+	if(config.binary)
+		return;
+	// 6 significant digits, like cout's default
+	chunk.text.resize((size_t)chunk.count * D * 16);
+	char* cursor = &chunk.text[0];
+	for(int i = 0; i < chunk.count; i++)
+	{
+		for(int j = 0; j < D; j++)
+		{
+			cursor = to_chars(cursor, cursor + 15, chunk.values[(size_t)i * D + j], chars_format::general, 6).ptr;
+			*cursor++ = j + 1 < D ? ' ' : '\n';
+		}
+	}
+	chunk.text.resize(cursor - &chunk.text[0]);
+	chunk.values.clear();
+}
+
+int main(int argc, char *argv[])
+{
+	GeneratorConfig config;
+	string out_path;
+	for(int a = 1; a < argc; a++)
+	{
+		string arg = argv[a];
+		if(arg.rfind("--points=", 0) == 0)
+			config.total_points = stoll(arg.substr(9));
+		else if(arg.rfind("--attr=", 0) == 0)
+			config.total_attr = stoi(arg.substr(7));
+		else if(arg.rfind("--k=", 0) == 0)
+			config.K = stoi(arg.substr(4));
+		else if(arg.rfind("--max-iterations=", 0) == 0)
+			config.max_iterations = stoi(arg.substr(17));
+		else if(arg.rfind("--separation=", 0) == 0)
+			config.separation = stod(arg.substr(13));
+		else if(arg.rfind("--duplicates=", 0) == 0)
+			config.duplicates = stod(arg.substr(13));
+		else if(arg.rfind("--seed=", 0) == 0)
+			config.seed = stoul(arg.substr(7));
+		else if(arg == "--format=binary")
+			config.binary = true;
+		else if(arg == "--format=text")
+			config.binary = false;
+		else if(arg.rfind("--out=", 0) == 0)
+			out_path = arg.substr(6);
+		else
+		{
+			cout << "Unknown option: " << arg << endl;
+			config.total_points = 0; // print usage below
+			break;
+		}
+	}
+	// The readers keep point counts in an int
+	if(config.total_points < 1 || config.total_points > INT32_MAX || config.total_attr < 1 || config.K < 1
+		|| config.K > config.total_points || config.duplicates < 0.0 || config.duplicates >= 1.0)
+	{
+		cout << "Usage: " << argv[0] << " [--points=1000000 (up to 2^31 - 1)] [--attr=8] [--k=16] [--max-iterations=100]"
+			<< " [--separation=10] [--duplicates=0.0 (fraction)] [--seed=123] [--format=text|binary] [--out=FILE (default stdout)]" << endl;
+		return 1;
+	}
+
+	ofstream file;
+	if(!out_path.empty())
+	{
+		file.open(out_path, ios::binary);
+		if(!file)
+		{
+			cerr << "Cannot write " << out_path << endl;
+			return 1;
+		}
+	}
+	ostream& out = out_path.empty() ? cout : file;
+	ios::sync_with_stdio(false);
+
+	vector<double> centers((size_t)config.K * config.total_attr);
+	mt19937_64 center_gen(config.seed);
+	uniform_real_distribution<double> center_value(-config.separation, config.separation);
+	for(auto& v : centers)
+		v = center_value(center_gen);
+
+	if(config.binary)
+	{
+		BinaryPointsHeader header = makeBinaryPointsHeader(config.total_points, config.total_attr, config.K, config.max_iterations);
+		out.write((const char*)&header, sizeof(header));
+	}
+	else
+		out << config.total_points << " " << config.total_attr << " " << config.K << " " << config.max_iterations << " 0\n";
+
+	auto begin = chrono::high_resolution_clock::now();
+	long long next_point = 0, bytes = 0;
+	tbb::parallel_pipeline(2 * tbb::this_task_arena::max_concurrency(),
+		tbb::make_filter<void, Chunk*>(tbb::filter_mode::serial_in_order,
+			[&](tbb::flow_control& fc) -> Chunk* {
+				if(next_point >= config.total_points)
+				{
+					fc.stop();
+					return nullptr;
+				}
+				Chunk* chunk = new Chunk();
+				chunk->first_point = next_point;
+				chunk->count = (int)min<long long>(CHUNK_POINTS, config.total_points - next_point);
+				next_point += chunk->count;
+				return chunk;
+			}) &
+		tbb::make_filter<Chunk*, Chunk*>(tbb::filter_mode::parallel,
+			[&](Chunk* chunk) {
+				generateChunk(config, centers, *chunk);
+				return chunk;
+			}) &
+		tbb::make_filter<Chunk*, void>(tbb::filter_mode::serial_in_order,
+			[&](Chunk* chunk) {
+				if(config.binary)
+				{
+					out.write((const char*)chunk->values.data(), chunk->values.size() * sizeof(double));
+					bytes += chunk->values.size() * sizeof(double);
+				}
+				else
+				{
+					out.write(chunk->text.data(), chunk->text.size());
+					bytes += chunk->text.size();
+				}
+				delete chunk;
+			})
+	);
+	out.flush();
+	auto end = chrono::high_resolution_clock::now();
+	if(!out)
+	{
+		cerr << "Write failed" << endl;
+		return 1;
+	}
+
+	double seconds = chrono::duration_cast<chrono::microseconds>(end - begin).count() / 1e6;
+	cerr << "Generated " << config.total_points << " points (" << bytes / 1e6 << " MB) in " << seconds << "s, "
+		<< bytes / 1e6 / seconds << " MB/s" << endl;
+	return 0;
+}
@@ -0,0 +1,275 @@
+// Asynchronous k-means runs on a shared TBB arena (libkmeans engines that report progress: parallel-fast,
+// parallel-strided).
+//
+//   KMeansScheduler scheduler(8);                        // one arena of 8 threads for all jobs
+//   KMeansFuture job = scheduler.submit("parallel-strided", matrix, options);
+//   ... job.progress().inertia, job.cancel(), job.waitFor(chrono::seconds(1)) ...
+//   KMeansResult result = job.get();
+//
+// submit() enqueues the job and returns at once. Jobs start in submission order and run side by side: every
+// pass of a job is a parallel loop whose ranges any idle worker of the arena may take, so concurrent jobs share
+// the workers instead of the first one holding all of them until it is done. A job is isolated from the others
+// (a thread waiting inside one job never picks up another job's work), so a short job never waits behind a long
+// one it happened to be nested in. Progress (iteration, changed points, inertia) is recorded after every pass;
+// cancel() stops the job at the next iteration boundary (a queued job does not start at all).
+//
+// Every job draws its initial centroids from its own copy of the rand() sequence (RunRandom), so concurrent jobs
+// give the same results as running them one by one.
+
+#ifndef KMEANS_JOBS_H
+#define KMEANS_JOBS_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <tbb/task_arena.h>
+#include "libkmeans.h"
+
+using namespace std;
+
+enum KMeansJobState { JOB_QUEUED, JOB_RUNNING, JOB_DONE, JOB_CANCELLED, JOB_FAILED };
+
+// Shared by the handle and the task running the job
+struct KMeansJob
+{
+	unique_ptr<KMeansEngine> engine;
+	KMeansMatrix matrix;
+	shared_ptr<const KMeansDataset> dataset; // keeps submitted datasets alive until the job is done
+	KMeansOptions options;
+
+	mutex lock;
+	condition_variable changed;
+	KMeansJobState state = JOB_QUEUED;
+	vector<KMeansProgress> history;        // one entry per finished pass
+	KMeansResult result;
+	exception_ptr error;
+	atomic<bool> cancel_requested{false};
+
+	bool finished()
+	{
+		return state == JOB_DONE || state == JOB_CANCELLED || state == JOB_FAILED;
+	}
+
+	void setState(KMeansJobState state)
+	{
+		lock_guard<mutex> guard(lock);
+		this->state = state;
+		changed.notify_all();
+	}
+
+	// Runs on a worker of the scheduler's arena
+	void run()
+	{
+		if(cancel_requested)
+		{
+			setState(JOB_CANCELLED);
+			return;
+		}
+		setState(JOB_RUNNING);
+
+		// Record every pass, then ask the caller's callback (if any) and the handle whether to go on
+		function<bool(const KMeansProgress&)> caller_progress = options.progress;
+		options.progress = [this, caller_progress](const KMeansProgress& state) {
+			{
+				lock_guard<mutex> guard(lock);
+				history.push_back(state);
+				changed.notify_all();
+			}
+			bool go_on = !caller_progress || caller_progress(state);
+			return go_on && !cancel_requested;
+		};
+
+		KMeansResult run_result;
+		exception_ptr run_error;
+		try
+		{
+			tbb::this_task_arena::isolate([&]() {
+				run_result = engine->runMatrix(matrix, options);
+			});
+		}
+		catch(...)
+		{
+			run_error = current_exception();
+		}
+		engine.reset();
+
+		lock_guard<mutex> guard(lock);
+		result = move(run_result);
+		error = run_error;
+		state = error ? JOB_FAILED : (result.cancelled ? JOB_CANCELLED : JOB_DONE);
+		dataset.reset();
+		changed.notify_all();
+	}
+};
+
+// Future-like handle of a submitted job; copies refer to the same job
+class KMeansFuture
+{
+private:
+	shared_ptr<KMeansJob> job;
+
+public:
+	KMeansFuture() {}
+	KMeansFuture(shared_ptr<KMeansJob> job) : job(job) {}
+
+	// False for a default constructed handle or a refused submit()
+	bool valid() const
+	{
+		return job != nullptr;
+	}
+
+	KMeansJobState state() const
+	{
+		lock_guard<mutex> guard(job->lock);
+		return job->state;
+	}
+
+	bool ready() const
+	{
+		lock_guard<mutex> guard(job->lock);
+		return job->finished();
+	}
+
+	void wait() const
+	{
+		unique_lock<mutex> guard(job->lock);
+		job->changed.wait(guard, [this]() { return job->finished(); });
+	}
+
+	// True if the job finished within timeout
+	template <class Rep, class Period>
+	bool waitFor(const chrono::duration<Rep, Period>& timeout) const
+	{
+		unique_lock<mutex> guard(job->lock);
+		return job->changed.wait_for(guard, timeout, [this]() { return job->finished(); });
+	}
+
+	// Blocks until the job finished; rethrows what the engine threw. A cancelled job returns the centroids and
+	// labels of its last pass (empty if it never started).
+	KMeansResult get() const
+	{
+		wait();
+		lock_guard<mutex> guard(job->lock);
+		if(job->error)
+			rethrow_exception(job->error);
+		return job->result;
+	}
+
+	// Stops the job at the next iteration boundary
+	void cancel()
+	{
+		job->cancel_requested = true;
+	}
+
+	// Last finished pass (iteration 0 before the first one)
+	KMeansProgress progress() const
+	{
+		lock_guard<mutex> guard(job->lock);
+		return job->history.empty() ? KMeansProgress{ 0, 0, 0.0 } : job->history.back();
+	}
+
+	vector<KMeansProgress> history() const
+	{
+		lock_guard<mutex> guard(job->lock);
+		return job->history;
+	}
+
+	// Blocks until a pass after the given iteration finished or the job is over; returns the last pass
+	KMeansProgress waitForProgress(int after_iteration) const
+	{
+		unique_lock<mutex> guard(job->lock);
+		job->changed.wait(guard, [&]() {
+			return job->finished() || (!job->history.empty() && job->history.back().iteration > after_iteration);
+		});
+		return job->history.empty() ? KMeansProgress{ 0, 0, 0.0 } : job->history.back();
+	}
+};
+
+class KMeansScheduler
+{
+private:
+	tbb::task_arena arena;
+	mutex lock;
+	condition_variable idle;
+	int pending = 0;                       // submitted jobs not finished yet
+
+public:
+	// threads = 0: all cores
+	KMeansScheduler(int threads = 0) : arena(threads > 0 ? threads : tbb::task_arena::automatic) {}
+
+	KMeansScheduler(const KMeansScheduler&) = delete;
+	KMeansScheduler& operator=(const KMeansScheduler&) = delete;
+
+	// Waits for the jobs still running (cancel them first to get out quickly)
+	~KMeansScheduler()
+	{
+		wait();
+	}
+
+	void wait()
+	{
+		unique_lock<mutex> guard(lock);
+		idle.wait(guard, [this]() { return pending == 0; });
+	}
+
+	int concurrency()
+	{
+		return arena.max_concurrency();
+	}
+
+	// The rows stay owned by the caller and must outlive the job. options.threads is ignored (all jobs share
+	// the arena); options.progress, if set, is called on the job's thread after every pass. Returns an invalid
+	// future for an unknown engine or one that does not report progress.
+	KMeansFuture submit(const string& engine_name, const KMeansMatrix& matrix, const KMeansOptions& options)
+	{
+		return enqueue(engine_name, matrix, nullptr, options);
+	}
+
+	// A loaded dataset, kept alive by the job; K and max_iterations default to the dataset header
+	KMeansFuture submit(const string& engine_name, shared_ptr<const KMeansDataset> data, KMeansOptions options)
+	{
+		KMeansMatrix matrix;
+		matrix.data = data->values.data();
+		matrix.total_points = data->total_points;
+		matrix.total_attr = data->total_attr;
+		matrix.row_stride = data->total_attr * sizeof(double);
+		if(options.K <= 0)
+			options.K = data->K;
+		if(options.max_iterations <= 0)
+			options.max_iterations = data->max_iterations;
+		return enqueue(engine_name, matrix, data, options);
+	}
+
+private:
+	KMeansFuture enqueue(const string& engine_name, const KMeansMatrix& matrix, shared_ptr<const KMeansDataset> data,
+		const KMeansOptions& options)
+	{
+		unique_ptr<KMeansEngine> engine = makeEngine(engine_name);
+		if(!engine || !engine->reportsProgress())
+			return KMeansFuture();
+
+		shared_ptr<KMeansJob> job = make_shared<KMeansJob>();
+		job->engine = move(engine);
+		job->matrix = matrix;
+		job->dataset = data;
+		job->options = options;
+		{
+			lock_guard<mutex> guard(lock);
+			pending++;
+		}
+		arena.enqueue([this, job]() {
+			job->run();
+			lock_guard<mutex> guard(lock);
+			if(--pending == 0)
+				idle.notify_all();
+		});
+		return KMeansFuture(job);
+	}
+};
+
+#endif
@@ -0,0 +1,166 @@
+// Load generator for the prediction server (bin/kmeans-parallel-fast --serve=SOCKET --model=MODEL).
+// Each client thread opens its own connection and sends back-to-back assign requests of random points,
+// then the round-trip latencies of all clients are summarized next to the server's own counters.
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <random>
+#include <algorithm>
+#include <chrono>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <string.h>
+#include "assign-protocol.h"
+
+using namespace std;
+
+int connectTo(const string& socket_path)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+	if(fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+	{
+		cerr << "Cannot connect to " << socket_path << ": " << strerror(errno) << endl;
+		if(fd >= 0)
+			close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+bool queryStats(int fd, ServerStats& stats)
+{
+	RequestHeader request = { REQUEST_MAGIC, REQUEST_STATS, 0, 0 };
+	ResponseHeader response;
+	return writeFull(fd, &request, sizeof(request)) && readFull(fd, &response, sizeof(response))
+		&& response.status == STATUS_OK && readFull(fd, &stats, sizeof(stats));
+}
+
+double percentile(vector<double>& sorted, int p)
+{
+	if(sorted.empty())
+		return 0.0;
+	return sorted[min(sorted.size() - 1, sorted.size() * p / 100)];
+}
+
+int main(int argc, char *argv[])
+{
+	string socket_path;
+	int clients = 4, requests = 10000, batch = 1;
+	double scale = 1000.0; // points are uniform in [0, scale) on every attribute
+	for(int a = 1; a < argc; a++)
+	{
+		string arg = argv[a];
+		if(arg.rfind("--socket=", 0) == 0)
+			socket_path = arg.substr(9);
+		else if(arg.rfind("--clients=", 0) == 0)
+			clients = stoi(arg.substr(10));
+		else if(arg.rfind("--requests=", 0) == 0)
+			requests = stoi(arg.substr(11));
+		else if(arg.rfind("--batch=", 0) == 0)
+			batch = stoi(arg.substr(8));
+		else if(arg.rfind("--scale=", 0) == 0)
+			scale = stod(arg.substr(8));
+		else
+		{
+			cout << "Unknown option: " << arg << endl;
+			socket_path.clear(); // print usage below
+			break;
+		}
+	}
+	if(socket_path.empty() || clients < 1 || requests < 1 || batch < 1)
+	{
+		cout << "Usage: " << argv[0] << " --socket=PATH [--clients=4] [--requests=10000 (per client)]"
+			<< " [--batch=1 (points per request)] [--scale=1000]" << endl;
+		return 1;
+	}
+
+	// The server tells us how many attributes a point has
+	int control_fd = connectTo(socket_path);
+	ServerStats stats;
+	if(control_fd < 0 || !queryStats(control_fd, stats))
+	{
+		cout << "No answer from the server" << endl;
+		return 1;
+	}
+	int total_attr = stats.total_attr;
+	cout << "Server model: K = " << stats.K << ", " << total_attr << " attributes" << endl;
+
+	vector<vector<double>> client_latencies(clients);
+	vector<int> client_errors(clients, 0);
+	vector<thread> threads;
+	auto begin = chrono::high_resolution_clock::now();
+	for(int c = 0; c < clients; c++)
+	{
+		threads.emplace_back([&, c]() {
+			int fd = connectTo(socket_path);
+			if(fd < 0)
+			{
+				client_errors[c] = requests;
+				return;
+			}
+			mt19937 gen(123 + c); // For reproducibility
+			uniform_real_distribution<double> uniform(0.0, scale);
+			vector<double> rows((size_t)batch * total_attr);
+			vector<int> labels(batch);
+			auto& latencies = client_latencies[c];
+			latencies.reserve(requests);
+
+			for(int r = 0; r < requests; r++)
+			{
+				for(auto& v : rows)
+					v = uniform(gen);
+				RequestHeader request = { REQUEST_MAGIC, REQUEST_ASSIGN, (uint32_t)batch, (uint32_t)total_attr };
+				ResponseHeader response;
+
+				auto sent = chrono::high_resolution_clock::now();
+				if(!writeFull(fd, &request, sizeof(request)) || !writeFull(fd, rows.data(), rows.size() * sizeof(double))
+					|| !readFull(fd, &response, sizeof(response)) || response.status != STATUS_OK
+					|| !readFull(fd, labels.data(), labels.size() * sizeof(int)))
+				{
+					client_errors[c] += requests - r;
+					break;
+				}
+				auto received = chrono::high_resolution_clock::now();
+				latencies.push_back(chrono::duration_cast<chrono::nanoseconds>(received - sent).count() / 1000.0);
+			}
+			close(fd);
+		});
+	}
+	for(auto& t : threads)
+		t.join();
+	auto end = chrono::high_resolution_clock::now();
+	double seconds = chrono::duration_cast<chrono::nanoseconds>(end - begin).count() / 1e9;
+
+	vector<double> all;
+	int errors = 0;
+	for(int c = 0; c < clients; c++)
+	{
+		all.insert(all.end(), client_latencies[c].begin(), client_latencies[c].end());
+		errors += client_errors[c];
+	}
+	sort(all.begin(), all.end());
+
+	cout << clients << " clients x " << requests << " requests x " << batch << " points" << endl;
+	cout << "Completed: " << all.size() << " requests (" << errors << " failed) in " << seconds << "s" << endl;
+	cout << "Throughput: " << (long long)(all.size() / seconds) << " requests/sec, "
+		<< (long long)(all.size() * batch / seconds) << " points/sec" << endl;
+	cout << "Client round trip: p50 = " << percentile(all, 50) << "μs, p99 = " << percentile(all, 99)
+		<< "μs, max = " << (all.empty() ? 0.0 : all.back()) << "μs" << endl;
+
+	if(queryStats(control_fd, stats))
+	{
+		cout << "Server: " << stats.requests << " requests, " << stats.points << " points in " << stats.batches
+			<< " batches (" << (stats.batches ? (double)stats.requests / stats.batches : 0.0) << " requests/batch)" << endl;
+		cout << "Server latency: p50 = " << stats.p50_us << "μs, p99 = " << stats.p99_us << "μs, max = "
+			<< stats.max_us << "μs" << endl;
+	}
+	close(control_fd);
+	return errors > 0;
+}
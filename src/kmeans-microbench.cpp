@@ -0,0 +1,229 @@
+// Microbenchmarks for the two hot kernels of the parallel implementation, in isolation from parsing/setup:
+//   nearest      the linear scan over K centroids of KMeans (linearScanNearest<SquaredL2>) for every point
+//   accumulate   the P1/P3 per-thread attribute sums (addWeighted into enumerable_thread_specific) + merge
+// Both call the engine's own inline kernels from distance-metrics.h, instantiated for double and float.
+// swept over D, K, element type (double/float) and layout (flat row-major matrix vs one vector per point,
+// which is what Point::values is). Every case gets warmup runs, then timed repetitions summarized as
+// median and MAD (median absolute deviation), per-point time and the bandwidth the points were read at.
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <random>
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/global_control.h>
+#include <tbb/task_arena.h>
+#include "distance-metrics.h" // the engine's kernels: squaredDistance, linearScanNearest, addWeighted
+
+using namespace std;
+
+struct BenchConfig
+{
+	int total_points = 100000;
+	int warmup = 2;
+	int reps = 10;
+	vector<int> dims = { 2, 8, 16, 64, 256 };
+	vector<int> ks = { 8, 64, 256 };
+};
+
+struct Summary
+{
+	double median_ns, mad_ns;
+};
+
+Summary summarize(vector<double> samples)
+{
+	sort(samples.begin(), samples.end());
+	double median = samples[samples.size() / 2];
+	vector<double> deviations;
+	for(double s : samples)
+		deviations.push_back(fabs(s - median));
+	sort(deviations.begin(), deviations.end());
+	return { median, deviations[deviations.size() / 2] };
+}
+
+// Runs fn warmup + reps times, returns the timed repetitions in ns
+template <class Fn>
+vector<double> timeRuns(const BenchConfig& config, Fn fn)
+{
+	vector<double> samples;
+	for(int r = 0; r < config.warmup + config.reps; r++)
+	{
+		auto begin = chrono::high_resolution_clock::now();
+		fn();
+		auto end = chrono::high_resolution_clock::now();
+		if(r >= config.warmup)
+			samples.push_back(chrono::duration_cast<chrono::nanoseconds>(end - begin).count());
+	}
+	return samples;
+}
+
+// Same points in both layouts
+template <class T>
+struct Dataset
+{
+	vector<T> flat;
+	vector<vector<T>> rows;
+	vector<T> centroids;
+	vector<int> labels;
+	int total_attr;
+
+	Dataset(int total_points, int total_attr, int K, bool with_rows)
+	{
+		this->total_attr = total_attr;
+		mt19937 gen(123); // For reproducibility
+		uniform_real_distribution<double> uniform(0.0, 1000.0);
+		flat.resize((size_t)total_points * total_attr);
+		for(auto& v : flat)
+			v = uniform(gen);
+		if(with_rows)
+			for(int i = 0; i < total_points; i++)
+				rows.emplace_back(flat.begin() + (size_t)i * total_attr, flat.begin() + (size_t)(i + 1) * total_attr);
+		centroids.assign(flat.begin(), flat.begin() + (size_t)K * total_attr);
+		labels.resize(total_points);
+	}
+
+	const T* row(int i, bool flat_layout) const
+	{
+		return flat_layout ? &flat[(size_t)i * total_attr] : rows[i].data();
+	}
+};
+
+void printRow(const string& kernel, const string& type, const string& layout, int D, int K,
+	const Summary& summary, int total_points, double bytes)
+{
+	double ns_per_point = summary.median_ns / total_points;
+	double gb_per_s = bytes / summary.median_ns; // bytes per ns = GB/s
+	cout << kernel << "\t" << type << "\t" << layout << "\t" << D << "\t" << K << "\t"
+		<< summary.median_ns / 1000.0 << "\t" << summary.mad_ns / 1000.0 << "\t"
+		<< ns_per_point << "\t" << gb_per_s << "\n";
+}
+
+template <class T>
+void benchNearest(const BenchConfig& config, const string& type, int D, int K)
+{
+	int n = config.total_points;
+	Dataset<T> data(n, D, K, true);
+	for(bool flat_layout : { true, false })
+	{
+		auto samples = timeRuns(config, [&]() {
+			tbb::parallel_for(tbb::blocked_range<int>(0, n), [&](const tbb::blocked_range<int>& r) {
+				for(int i = r.begin(); i < r.end(); i++)
+				{
+					T min_dist;
+					data.labels[i] = linearScanNearest<SquaredL2>(data.row(i, flat_layout), data.centroids.data(), K, D, min_dist);
+				}
+			});
+		});
+		// Centroids stay in cache, the points are the traffic
+		printRow("nearest", type, flat_layout ? "flat" : "vector", D, K, summarize(samples), n, (double)n * D * sizeof(T));
+	}
+}
+
+template <class T>
+void benchAccumulate(const BenchConfig& config, const string& type, int D, int K)
+{
+	int n = config.total_points;
+	Dataset<T> data(n, D, K, true);
+	for(int i = 0; i < n; i++)
+		data.labels[i] = i % K;
+	vector<double> sums((size_t)K * D);
+
+	for(bool flat_layout : { true, false })
+	{
+		auto samples = timeRuns(config, [&]() {
+			// As in run(): thread local K x D sums (vector per cluster), merged after the loop
+			tbb::enumerable_thread_specific<vector<vector<double>>> thread_local_sums(
+				[&]() { return vector<vector<double>>(K, vector<double>(D, 0.0)); }
+			);
+			tbb::parallel_for(tbb::blocked_range<int>(0, n), [&](const tbb::blocked_range<int>& r) {
+				auto& local_sums = thread_local_sums.local();
+				for(int i = r.begin(); i < r.end(); i++)
+					addWeighted(local_sums[data.labels[i]].data(), data.row(i, flat_layout), 1.0, D);
+			});
+			fill(sums.begin(), sums.end(), 0.0);
+			for(const auto& local_sums : thread_local_sums)
+				for(int c = 0; c < K; c++)
+					for(int j = 0; j < D; j++)
+						sums[(size_t)c * D + j] += local_sums[c][j];
+		});
+		printRow("accumulate", type, flat_layout ? "flat" : "vector", D, K, summarize(samples), n, (double)n * D * sizeof(T));
+	}
+}
+
+vector<int> parseList(const string& list)
+{
+	vector<int> values;
+	stringstream ss(list);
+	string item;
+	while(getline(ss, item, ','))
+		values.push_back(stoi(item));
+	return values;
+}
+
+int main(int argc, char *argv[])
+{
+	BenchConfig config;
+	int threads = 0;
+	bool run_nearest = true, run_accumulate = true;
+	for(int a = 1; a < argc; a++)
+	{
+		string arg = argv[a];
+		if(arg.rfind("--points=", 0) == 0)
+			config.total_points = stoi(arg.substr(9));
+		else if(arg.rfind("--reps=", 0) == 0)
+			config.reps = stoi(arg.substr(7));
+		else if(arg.rfind("--warmup=", 0) == 0)
+			config.warmup = stoi(arg.substr(9));
+		else if(arg.rfind("--dims=", 0) == 0)
+			config.dims = parseList(arg.substr(7));
+		else if(arg.rfind("--ks=", 0) == 0)
+			config.ks = parseList(arg.substr(5));
+		else if(arg.rfind("--threads=", 0) == 0)
+			threads = stoi(arg.substr(10));
+		else if(arg == "--kernel=nearest")
+			run_accumulate = false;
+		else if(arg == "--kernel=accumulate")
+			run_nearest = false;
+		else
+		{
+			cout << "Usage: " << argv[0] << " [--points=100000] [--reps=10] [--warmup=2] [--dims=2,8,16,64,256]"
+				<< " [--ks=8,64,256] [--threads=N] [--kernel=nearest|accumulate]" << endl;
+			return 1;
+		}
+	}
+	if(config.reps < 1 || config.total_points < 1)
+	{
+		cout << "Need at least one repetition and one point" << endl;
+		return 1;
+	}
+
+	tbb::global_control control(tbb::global_control::max_allowed_parallelism,
+		threads > 0 ? threads : tbb::this_task_arena::max_concurrency());
+	cout << config.total_points << " points, " << config.warmup << " warmup + " << config.reps << " timed runs, "
+		<< tbb::global_control::active_value(tbb::global_control::max_allowed_parallelism) << " threads\n";
+	cout << "KERNEL\tTYPE\tLAYOUT\tD\tK\tMEDIAN(μs)\tMAD(μs)\tNS/POINT\tGB/S\n";
+	for(int D : config.dims)
+		for(int K : config.ks)
+		{
+			if(K > config.total_points)
+				continue;
+			if(run_nearest)
+			{
+				benchNearest<double>(config, "f64", D, K);
+				benchNearest<float>(config, "f32", D, K);
+			}
+			if(run_accumulate)
+			{
+				benchAccumulate<double>(config, "f64", D, K);
+				benchAccumulate<float>(config, "f32", D, K);
+			}
+		}
+	return 0;
+}
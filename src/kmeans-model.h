@@ -0,0 +1,143 @@
+// Trained model file: what KMeans::run leaves behind, in a compact binary form for predict/serve.
+//
+// Layout (native little-endian):
+//   char[4]  magic "KMDL"
+//   uint32   version (1, or 2 if the file has MODEL_HAS_SCALING)
+//   uint32   K
+//   uint32   total_attr
+//   uint32   dtype (MODEL_FLOAT64 / MODEL_FLOAT32) of every array below
+//   uint32   flags (MODEL_HAS_NORMS | MODEL_HAS_SCALING)
+//   K * total_attr   centroids, row major
+//   K                squared centroid norms (if MODEL_HAS_NORMS)
+//   if MODEL_HAS_SCALING: uint32 ScalingMethod, then total_attr offsets and total_attr factors (always float64).
+//   Centroids/norms are then in the scaled space and inputs must go through the same scaling before assignment.
+
+#ifndef KMEANS_MODEL_H
+#define KMEANS_MODEL_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <stdint.h>
+#include <string.h>
+#include "feature-scaling.h"
+
+using namespace std;
+
+enum ModelDType { MODEL_FLOAT64 = 0, MODEL_FLOAT32 = 1 };
+
+const uint32_t MODEL_VERSION = 1;
+const uint32_t MODEL_VERSION_SCALING = 2;
+const uint32_t MODEL_HAS_NORMS = 1;
+const uint32_t MODEL_HAS_SCALING = 2;
+
+struct KMeansModel
+{
+	int K = 0;
+	int total_attr = 0;
+	vector<double> centroids; // K * total_attr
+	vector<double> norms;     // K, empty if not stored
+	FeatureScaling scaling;   // what the training data went through
+};
+
+// Squared norm of every centroid
+inline void computeModelNorms(KMeansModel& model)
+{
+	model.norms.assign(model.K, 0.0);
+	for(int i = 0; i < model.K; i++)
+		for(int j = 0; j < model.total_attr; j++)
+		{
+			double v = model.centroids[(size_t)i * model.total_attr + j];
+			model.norms[i] += v * v;
+		}
+}
+
+inline void writeModelArray(ofstream& out, const vector<double>& values, ModelDType dtype)
+{
+	if(dtype == MODEL_FLOAT64)
+	{
+		out.write((const char*)values.data(), values.size() * sizeof(double));
+		return;
+	}
+	vector<float> narrow(values.begin(), values.end());
+	out.write((const char*)narrow.data(), narrow.size() * sizeof(float));
+}
+
+inline bool readModelArray(ifstream& in, vector<double>& values, size_t count, ModelDType dtype)
+{
+	values.resize(count);
+	if(dtype == MODEL_FLOAT64)
+		return (bool)in.read((char*)values.data(), count * sizeof(double));
+	vector<float> narrow(count);
+	if(!in.read((char*)narrow.data(), count * sizeof(float)))
+		return false;
+	copy(narrow.begin(), narrow.end(), values.begin());
+	return true;
+}
+
+inline bool writeModel(const string& path, const KMeansModel& model, ModelDType dtype)
+{
+	ofstream out(path, ios::binary);
+	if(!out)
+	{
+		cerr << "Cannot write model file " << path << endl;
+		return false;
+	}
+	bool scaled = model.scaling.enabled();
+	uint32_t header[5] = { scaled ? MODEL_VERSION_SCALING : MODEL_VERSION, (uint32_t)model.K, (uint32_t)model.total_attr,
+		(uint32_t)dtype, (model.norms.empty() ? 0u : MODEL_HAS_NORMS) | (scaled ? MODEL_HAS_SCALING : 0u) };
+	out.write("KMDL", 4);
+	out.write((const char*)header, sizeof(header));
+	writeModelArray(out, model.centroids, dtype);
+	if(!model.norms.empty())
+		writeModelArray(out, model.norms, dtype);
+	if(scaled)
+	{
+		uint32_t method = model.scaling.method;
+		out.write((const char*)&method, sizeof(method));
+		writeModelArray(out, model.scaling.offset, MODEL_FLOAT64);
+		writeModelArray(out, model.scaling.factor, MODEL_FLOAT64);
+	}
+	return (bool)out;
+}
+
+inline bool readModel(const string& path, KMeansModel& model)
+{
+	ifstream in(path, ios::binary);
+	char magic[4];
+	uint32_t header[5];
+	if(!in || !in.read(magic, 4) || memcmp(magic, "KMDL", 4) != 0 || !in.read((char*)header, sizeof(header)))
+	{
+		cerr << "Not a model file: " << path << endl;
+		return false;
+	}
+	if(header[0] < MODEL_VERSION || header[0] > MODEL_VERSION_SCALING || header[3] > MODEL_FLOAT32)
+	{
+		cerr << "Unsupported model version/dtype in " << path << endl;
+		return false;
+	}
+
+	model.K = header[1];
+	model.total_attr = header[2];
+	ModelDType dtype = (ModelDType)header[3];
+	bool ok = readModelArray(in, model.centroids, (size_t)model.K * model.total_attr, dtype);
+	if(ok && (header[4] & MODEL_HAS_NORMS))
+		ok = readModelArray(in, model.norms, model.K, dtype);
+	else
+		model.norms.clear();
+	model.scaling = FeatureScaling();
+	if(ok && (header[4] & MODEL_HAS_SCALING))
+	{
+		uint32_t method;
+		ok = in.read((char*)&method, sizeof(method)) && method <= SCALE_MINMAX
+			&& readModelArray(in, model.scaling.offset, model.total_attr, MODEL_FLOAT64)
+			&& readModelArray(in, model.scaling.factor, model.total_attr, MODEL_FLOAT64);
+		model.scaling.method = (ScalingMethod)method;
+	}
+	if(!ok)
+		cerr << "Truncated model file: " << path << endl;
+	return ok;
+}
+
+#endif
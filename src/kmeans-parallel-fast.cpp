@@ -18,7 +18,28 @@
 #include <tbb/blocked_range.h>
 #include <tbb/enumerable_thread_specific.h>
 #include <mutex>
+#include <random>
 #include <tbb/global_control.h> // to control the number of threads
+#include <tbb/concurrent_hash_map.h>
+#include <tbb/parallel_pipeline.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+#include "ball-tree.h"
+#include "pq-index.h"
+#include "projection.h"
+#include "coreset.h"
+#include "feature-scaling.h"
+#include "quantized-points.h"
+#include "sparse-points.h"
+#include "distance-metrics.h"
+#include "binary-points.h"
+#include "kmeans-model.h"
+#include "assign-server.h"
+#include "iteration-trace.h"
+#include "perf-counters.h"
+#include "memory-footprint.h"
+#include "libkmeans.h"
 
 using namespace std;
 
@@ -28,6 +49,7 @@ private:
 	int id_point, id_cluster;
 	vector<double> values;
 	int total_attr;
+	long long weight; // number of input rows this point stands for (duplicates collapsed by dedupePoints, coreset merges)
 	string name;
 
 public:
@@ -36,11 +58,24 @@ public:
 		this->id_point = id_point;
 		total_attr = values.size();
 
+		this->values.reserve(total_attr); // exactly D doubles on the heap, not the next power of two
 		for(int i = 0; i < total_attr; i++)
 			this->values.push_back(values[i]);
 
 		this->name = name;
 		id_cluster = -1;
+		weight = 1;
+	}
+
+	// Copies total_attr values from a row the caller owns (PointEngine)
+	Point(int id_point, const double* values, int total_attr, string name = "")
+	{
+		this->id_point = id_point;
+		this->total_attr = total_attr;
+		this->values.assign(values, values + total_attr);
+		this->name = name;
+		id_cluster = -1;
+		weight = 1;
 	}
 
 	int getID()
@@ -82,8 +117,37 @@ public:
 	{
 		return name;
 	}
+
+	void setName(const string& name)
+	{
+		this->name = name;
+	}
+
+	long long getWeight()
+	{
+		return weight;
+	}
+
+	// Heap behind this point: the values, the name when it is too long for the string itself
+	size_t heapBytes()
+	{
+		return heapBlockBytes(values.capacity() * sizeof(double)) + stringHeapBytes(name.capacity());
+	}
+
+	void setWeight(long long weight)
+	{
+		this->weight = weight;
+	}
 };
 
+enum NearestEngine { NEAREST_AUTO, NEAREST_LINEAR, NEAREST_BALLTREE, NEAREST_PQ };
+
+// Thresholds for NEAREST_AUTO
+const int BALLTREE_MIN_K = 256;
+const int BALLTREE_MAX_ATTR = 32;
+
+// Metric is a distance policy from distance-metrics.h (compile time, so the kernels inline into the loops)
+template <class Metric = SquaredL2>
 class KMeans
 {
 private:
@@ -91,7 +155,55 @@ private:
 	int total_attr, total_points, max_iterations;
 	vector<double> centralValues;     // K * total_attr
 	vector<double> attributeSums;     // K * total_attr
-	vector<int>    clusterCounts;     // K
+	vector<long long> clusterCounts;  // K, weighted
+
+	NearestEngine nearest_engine = NEAREST_AUTO;  // requested
+	NearestEngine active_engine = NEAREST_LINEAR; // resolved at the start of run()
+	CentroidBallTree centroidTree;                // index over centralValues, rebuilt every iteration
+	CentroidProductQuantizer centroidPQ;          // approximate (NEAREST_PQ only), retrained every iteration
+	tbb::enumerable_thread_specific<CentroidProductQuantizer::Scratch> pqScratch;
+
+	bool verbose = true;                  // print progress/results from run()
+	int iterations = 0;                   // Lloyd iterations done by the last run()
+	long long total_us = 0, init_us = 0;  // its run time and the phase 1 part of it
+	vector<double> initial_centroids;     // K * total_attr seeds used instead of initializeClusterCentroids
+	long long seed_us = 0;                // time spent producing initial_centroids before run(), part of phase 1
+	vector<int> source_rows;              // input row -> weighted point, when duplicates were collapsed
+	vector<int>* label_array = nullptr;   // setLabelArray: the point clusters live here instead of in the points
+
+	// Reduced-space pre-stage (reduced_attr == 0 disables it)
+	int reduced_attr = 0;
+	ReductionMethod reduction_method = REDUCE_RANDOM_PROJECTION;
+	int refine_iterations = 10;           // full-space iterations after the pre-stage
+
+	// Subsample warm start (subsample_fraction == 0 disables it)
+	double subsample_fraction = 0.0;
+	int subsample_size = 0;
+
+	int prestage_iterations = 0;          // Lloyd iterations done by whichever pre-stage ran
+	int touched_clusters = 0;             // by the last ingest()
+
+	bool seeded = false;                  // own generator instead of the global rand() (see setSeed)
+	mt19937 gen;
+	shared_ptr<RunRandom> rand_sequence;  // private copy of the rand() sequence (see setRandSeed)
+
+	string model_path;                    // written at the end of run() when set
+	ModelDType model_dtype = MODEL_FLOAT64;
+
+	FeatureScaling scaling;               // points were scaled with this: centroids get un-scaled when printed
+
+	// Quantized assignment (setQuantizedPoints): the Lloyd loop reads these instead of the Point values
+	const QuantizedPoints* quantized = nullptr;
+	vector<int16_t> quantizedCentroids;   // centroids on the same grid, rebuilt with the index every iteration
+	vector<int> quantizedLabels;
+	atomic<long long> quantized_rechecks{0};
+
+	size_t accumulator_bytes = 0;         // largest set of thread local accumulators in the last run()
+
+	IterationTrace* trace = nullptr;      // per-iteration phase timings of run() when set
+	function<bool(const KMeansProgress&)> progress; // called after every dense Lloyd iteration, false stops run()
+	bool cancelled = false;               // the last run() was stopped by progress
+	PhaseCounters* counters = nullptr;    // hardware counters per phase of run() when set
 
 	// Helper function to get index in flattened vectors
 	int getClusterIndex(int cluster_id, int attr) {
@@ -99,268 +211,2489 @@ private:
 	}
 
 	// Return ID of nearest center (uses euclidean distance)
-	int findNearestCluster(Point point)
+	int findNearestCluster(Point& point)
 	{
-		double sum = 0.0, min_dist;
-		int id_cluster_center = 0;
-
-		for(int i = 0; i < total_attr; i++)
-		{
-			double diff = centralValues[i] - point.getValue(i);
-			sum += diff * diff;
-		}
+		return findNearestCentroid(point.getValues().data());
+	}
 
-		min_dist = sum;
+	int findNearestCluster(Point& point, double& min_dist)
+	{
+		return findNearestCentroid(point.getValues().data(), min_dist);
+	}
 
-		for(int i = 1; i < K; i++)
-		{
-			sum = 0.0;
-			double* c_vals = &centralValues[getClusterIndex(i, 0)];
-			double* p_vals = point.getValues().data();
+	int findNearestCentroid(const double* p_vals)
+	{
+		double min_dist;
+		return findNearestCentroid(p_vals, min_dist);
+	}
 
-			// Process 4 doubles at a time
-			int j;
-			#pragma omp simd
-			for(j = 0; j + 3 < total_attr; j += 4)
-			{
-				double diff0 = c_vals[j] - p_vals[j];
-				double diff1 = c_vals[j+1] - p_vals[j+1];
-				double diff2 = c_vals[j+2] - p_vals[j+2];
-				double diff3 = c_vals[j+3] - p_vals[j+3];
-				sum += diff0 * diff0 + diff1 * diff1 + diff2 * diff2 + diff3 * diff3;
-			}
+	// min_dist is the metric's distance (squared for L2, approximate with PQ)
+	int findNearestCentroid(const double* p_vals, double& min_dist)
+	{
+		if(active_engine == NEAREST_BALLTREE)
+			return centroidTree.findNearest(p_vals, min_dist);
+		if(active_engine == NEAREST_PQ)
+			return centroidPQ.findNearest(p_vals, pqScratch.local(), min_dist);
+		return linearNearest(p_vals, min_dist);
+	}
 
-			// Cleanup loop for remaining elements
-			for(; j < total_attr; j++)
-			{
-				double diff = c_vals[j] - p_vals[j];
-				sum += diff * diff;
-			}
+	int linearNearest(const double* p_vals, double& min_dist)
+	{
+		return linearScanNearest<Metric>(p_vals, centralValues.data(), K, total_attr, min_dist);
+	}
 
-			if (sum < min_dist)
-			{
-				min_dist = sum;
-				id_cluster_center = i;
-			}
-		}
-		return id_cluster_center;
+	// Linear scan is hard to beat for small K, and ball trees stop pruning in high dimensions.
+	// PQ is approximate, so it is only used when asked for.
+	NearestEngine chooseNearestEngine()
+	{
+		if(!Metric::EUCLIDEAN)
+			return NEAREST_LINEAR; // the indexes are built for squared L2
+		if(nearest_engine != NEAREST_AUTO)
+			return nearest_engine;
+		if(K >= BALLTREE_MIN_K && total_attr <= BALLTREE_MAX_ATTR)
+			return NEAREST_BALLTREE;
+		return NEAREST_LINEAR;
 	}
 
-public:
-	KMeans(int K, int total_points, int total_attr, int max_iterations)
+	// Rebuild whatever index the active engine searches, after the centroids moved
+	void buildCentroidIndex()
 	{
-		this->K = K;
-		this->total_points = total_points;
-		this->total_attr = total_attr;
-		this->max_iterations = max_iterations;
-		
-		// Initialize vectors with correct sizes
-		centralValues.resize(K * total_attr);
-		attributeSums.resize(K * total_attr);
-		clusterCounts.resize(K);
+		if(active_engine == NEAREST_BALLTREE)
+			centroidTree.build(centralValues.data(), K, total_attr);
+		else if(active_engine == NEAREST_PQ)
+			centroidPQ.build(centralValues.data(), K, total_attr);
+		if(quantized != nullptr)
+			quantized->quantizeCentroids(centralValues.data(), K, quantizedCentroids);
 	}
 
-	void initializeClusterCentroids(vector<Point> & points)
+	// Nearest centroid of point i by integer distance on the quantized grid. Rounding the point and the centroid
+	// moves each coordinate difference by at most one grid step, i.e. every Euclidean distance by at most sqrt(D)
+	// grid steps either way; unless the runner-up is more than 2 * sqrt(D) further than the best, the order may
+	// be wrong and the point is decided in floating point instead.
+	int quantizedNearest(int i, Point& point)
 	{
-		// Manually initialize K cluster centroids with unique, random points
-		vector<int> prohibited_indexes;
-		for(int i = 0; i < K; i++)
+		int stride = quantized->getStride();
+		int64_t best = quantized->squaredDistance(i, &quantizedCentroids[0]), second = INT64_MAX;
+		int id_cluster_center = 0;
+		for(int c = 1; c < K; c++)
 		{
-			while(true)
+			int64_t dist = quantized->squaredDistance(i, &quantizedCentroids[(size_t)c * stride]);
+			if(dist < best)
 			{
-				int index_point = rand() % total_points; // Random seed is defined in main
-
-				if(find(prohibited_indexes.begin(), prohibited_indexes.end(),
-						index_point) == prohibited_indexes.end())
-				{
-					prohibited_indexes.push_back(index_point);
-					points[index_point].setCluster(i);
-					clusterCounts[i] = 1;
-					
-					// Copy point values to central values
-					for(int j = 0; j < total_attr; j++) {
-						centralValues[getClusterIndex(i, j)] = points[index_point].getValue(j);
-					}
-					break;
-				}
+				second = best;
+				best = dist;
+				id_cluster_center = c;
 			}
+			else if(dist < second)
+				second = dist;
 		}
-		return;
+		if(K > 1 && sqrt((double)second) - sqrt((double)best) <= 2.0 * sqrt((double)total_attr))
+		{
+			quantized_rechecks++;
+			double min_dist;
+			return linearNearest(point.getValues().data(), min_dist);
+		}
+		return id_cluster_center;
 	}
 
-	void run(vector<Point> & points)
+	// P1 + P3 of one Lloyd iteration on the quantized points: the sums are exact integer sums of the weighted
+	// grid values (thread local, like the double ones), turned back into attributeSums once per iteration.
+	// Returns true if no point moved.
+	bool assignQuantized(vector<Point> & points)
 	{
-		if(K > total_points)
-			return;
+		tbb::enumerable_thread_specific<vector<long long>> thread_local_point_diffs(
+			[&]() { return vector<long long>(K, 0); }
+		);
+		tbb::enumerable_thread_specific<vector<int64_t>> thread_local_grid_sums(
+			[&]() { return vector<int64_t>((size_t)K * total_attr, 0); }
+		);
 
-        auto begin = chrono::high_resolution_clock::now();
-		initializeClusterCentroids(points);
-        auto end_phase1 = chrono::high_resolution_clock::now();
+		tbb::parallel_for(tbb::blocked_range<int>(0, total_points), [&](const tbb::blocked_range<int>& r) {
+			auto& local_diffs = thread_local_point_diffs.local();
+			auto& local_sums = thread_local_grid_sums.local();
+			for(int i = r.begin(); i < r.end(); i++)
+			{
+				int id_old_cluster = quantizedLabels[i];
+				int id_nearest_center = quantizedNearest(i, points[i]);
+				int64_t weight = quantized->weight(i);
+				if(id_old_cluster != id_nearest_center)
+				{
+					if(id_old_cluster != -1)
+						local_diffs[id_old_cluster] -= weight;
+					local_diffs[id_nearest_center] += weight;
+					quantizedLabels[i] = id_nearest_center;
+				}
+				int64_t* sums = &local_sums[(size_t)id_nearest_center * total_attr];
+				for(int j = 0; j < total_attr; j++)
+					sums[j] += (int64_t)weight * quantized->value(i, j);
+			}
+		});
 
+		bool done = true;
+		for(const auto& local_diffs : thread_local_point_diffs)
+			for(int i = 0; i < K; i++)
+			{
+				if(local_diffs[i] != 0)
+					done = false;
+				clusterCounts[i] += local_diffs[i];
+			}
 
-		// ======================= RUN KMEANS ======================= //
-		int iter = 1;
-		bool done = false;
-		for (; !done && iter <= max_iterations; iter++)
-		{
-			done = true;
-			tbb::enumerable_thread_specific<vector<int>> thread_local_point_diffs(
-				[&]() { return vector<int>(K, 0); }
-			); // Basically, this creates a vector of size K with all elements initialized to 0 per thread
-			tbb::enumerable_thread_specific<vector<vector<double>>> thread_local_attribute_sums(
-				[&]() { return vector<vector<double>>(K, vector<double>(total_attr, 0.0)); }
-			); // 2-D vector, K x total_attr: Rows are clusters, columns are attributes
+		accumulator_bytes = max(accumulator_bytes, thread_local_grid_sums.size()
+			* (heapBlockBytes(K * sizeof(long long)) + heapBlockBytes((size_t)K * total_attr * sizeof(int64_t))));
 
-			// P1. Parallel for over all points to assign them to the nearest cluster
-			tbb::parallel_for(0, total_points, 1, [&](int i) {
-				// NOTE: Due to the nature of findNearestCluster, cluster information should NOT be changed in this loop
-				int id_old_cluster = points[i].getCluster();
-				int id_nearest_center = findNearestCluster(points[i]);
+		vector<int64_t> grid_sums((size_t)K * total_attr, 0);
+		for(const auto& local_sums : thread_local_grid_sums)
+			for(size_t s = 0; s < grid_sums.size(); s++)
+				grid_sums[s] += local_sums[s];
+		for(int i = 0; i < K; i++)
+			for(int j = 0; j < total_attr; j++)
+				attributeSums[getClusterIndex(i, j)] = quantized->dequantizeSum(grid_sums[getClusterIndex(i, j)], clusterCounts[i], j);
+		return done;
+	}
 
-				if(id_old_cluster != id_nearest_center)
+	// Fraction of points whose label from the active engine differs from the exact nearest centroid,
+	// both taken against the current centroids
+	double labelMismatchRate(vector<Point> & points)
+	{
+		buildCentroidIndex();
+		int mismatches = tbb::parallel_reduce(tbb::blocked_range<int>(0, total_points), 0,
+			[&](const tbb::blocked_range<int>& r, int count) {
+				for(int i = r.begin(); i < r.end(); i++)
 				{
-					// P3
-					auto& local_diffs = thread_local_point_diffs.local();
-					if (id_old_cluster != -1) {
-						local_diffs[id_old_cluster]--;
-					}
-					local_diffs[id_nearest_center]++;
-
-					points[i].setCluster(id_nearest_center);
+					double min_dist;
+					if(linearNearest(points[i].getValues().data(), min_dist) != findNearestCluster(points[i]))
+						count++;
 				}
+				return count;
+			}, plus<int>());
+		return (double)mismatches / total_points;
+	}
 
-				// P3
-				auto& local_sums = thread_local_attribute_sums.local();
-				double* p_vals = points[i].getValues().data();
-				#pragma omp simd
-				for (int j = 0; j < total_attr; j++) {
-					local_sums[id_nearest_center][j] += p_vals[j];
-				}
-			});
+	int labelOf(vector<Point> & points, int i)
+	{
+		return label_array != nullptr ? (*label_array)[i] : points[i].getCluster();
+	}
 
-			// P3. Updating num_points using the values of the differences accumulated in each threadLocalPointDiffs
-			for (const auto& local_diffs : thread_local_point_diffs) {
-				for (int i = 0; i < K; i++) {
-					if (done && local_diffs[i] != 0) { // Moved 'done' check here to remove race condition/contention
-						done = false;
-					}
-					clusterCounts[i] += local_diffs[i];
-				}
-			}
+	void setLabel(vector<Point> & points, int i, int label)
+	{
+		if(label_array != nullptr)
+			(*label_array)[i] = label;
+		else
+			points[i].setCluster(label);
+	}
 
-			// P3. Update attribute sums
-			for (const auto& local_sums : thread_local_attribute_sums) {
-				for (int i = 0; i < K; i++) {
-					double* sums = &attributeSums[getClusterIndex(i, 0)];
-					#pragma omp simd
-					for (int j = 0; j < total_attr; j++) {
-						sums[j] += local_sums[i][j];
-					}
-				}
-			}
+	// rand() unless setSeed or setRandSeed was called. The global rand() keeps the results identical to the other
+	// implementations, a per-instance generator lets several KMeans run concurrently and reproducibly.
+	unsigned int nextRandom()
+	{
+		if(seeded)
+			return (unsigned int)(gen() >> 1);
+		return rand_sequence ? (unsigned int)rand_sequence->next() : (unsigned int)rand();
+	}
 
-			// P2. parallelize clearing attributeSums
-			tbb::parallel_for(0, K, 1, [&](int i) {
-				if(clusterCounts[i] > 0) {
-					double* cent_vals = &centralValues[getClusterIndex(i, 0)];
-					double* sums = &attributeSums[getClusterIndex(i, 0)];
-					#pragma omp simd
-					for(int j = 0; j < total_attr; j++) {
-						cent_vals[j] = sums[j] / clusterCounts[i];
-					}
-				}
-				// Clear attribute sums for next iteration
-				fill(&attributeSums[getClusterIndex(i, 0)], &attributeSums[getClusterIndex(i, total_attr)], 0.0);
-			});
-		}
+	// Centroids = mean of the points carrying each label; also sets the point clusters and clusterCounts
+	// so the next iteration only counts real moves
+	void seedFromLabels(vector<Point> & points, const vector<int>& labels)
+	{
+		tbb::enumerable_thread_specific<vector<double>> thread_local_sums(
+			[&]() { return vector<double>(K * total_attr, 0.0); }
+		);
+		tbb::enumerable_thread_specific<vector<long long>> thread_local_counts(
+			[&]() { return vector<long long>(K, 0); }
+		);
+		tbb::parallel_for(0, total_points, 1, [&](int i) {
+			int label = labels[i];
+			double weight = points[i].getWeight();
+			setLabel(points, i, label);
+			thread_local_counts.local()[label] += points[i].getWeight();
+			double* sums = &thread_local_sums.local()[getClusterIndex(label, 0)];
+			double* p_vals = points[i].getValues().data();
+			#pragma omp simd
+			for (int j = 0; j < total_attr; j++) {
+				sums[j] += weight * p_vals[j];
+			}
+		});
 
-		cout << "Break in iteration " << iter << "\n\n";
-        auto end = chrono::high_resolution_clock::now();
+		fill(attributeSums.begin(), attributeSums.end(), 0.0);
+		fill(clusterCounts.begin(), clusterCounts.end(), 0);
+		for (const auto& local_sums : thread_local_sums)
+			for (int j = 0; j < K * total_attr; j++)
+				attributeSums[j] += local_sums[j];
+		for (const auto& local_counts : thread_local_counts)
+			for (int i = 0; i < K; i++)
+				clusterCounts[i] += local_counts[i];
 
-		// Output Results
 		for(int i = 0; i < K; i++)
 		{
-			cout << "Cluster " << i + 1 << ": ";
-			for(int j = 0; j < total_attr; j++)
-				cout << centralValues[getClusterIndex(i, j)] << " ";
-			cout << "\n\n";
+			if(clusterCounts[i] > 0)
+			{
+				for(int j = 0; j < total_attr; j++)
+					centralValues[getClusterIndex(i, j)] = attributeSums[getClusterIndex(i, j)] / clusterCounts[i];
+			}
+			else
+			{
+				// Nobody landed here in the reduced space, restart it from a random point
+				int index_point = nextRandom() % total_points;
+				for(int j = 0; j < total_attr; j++)
+					centralValues[getClusterIndex(i, j)] = points[index_point].getValue(j);
+			}
 		}
-		cout << "TOTAL EXECUTION TIME = "<<chrono::duration_cast<chrono::microseconds>(end-begin).count()<<"μs\n";
-		cout << "TIME PHASE 1 = "<<chrono::duration_cast<chrono::microseconds>(end_phase1-begin).count()<<"μs\n";
-		cout << "TIME PHASE 2 = "<<chrono::duration_cast<chrono::microseconds>(end-end_phase1).count()<<"μs\n" << endl;
-		cout << "AV TIME PER ITERATION = " << (chrono::duration_cast<chrono::microseconds>(end-begin).count() / iter) << "μs\n\n\n" << endl;
+		fill(attributeSums.begin(), attributeSums.end(), 0.0);
 	}
-};
 
-int main(int argc, char *argv[])
-{
-	string first_line;
-	getline(cin, first_line);
+	// Project the points to reduced_attr dimensions, run the whole engine there, then lift the clustering
+	// back: each centroid becomes the full-space mean of the points it owned in the reduced space.
+	void runReducedSpaceStage(vector<Point> & points)
+	{
+		LinearProjection projection;
+		unsigned int seed = nextRandom(); // Random seed is defined in main (or setSeed)
+		if(reduction_method == REDUCE_PCA)
+			projection.fitPCA(points, total_points, total_attr, reduced_attr, seed);
+		else
+			projection.fitRandom(total_attr, reduced_attr, seed);
 
-	// IMPORTANT: Remove byte-order-mark (BOM) if it exists
-	if (first_line.size() > 0 && first_line[0] == '\xEF' && first_line[1] == '\xBB' && first_line[2] == '\xBF') {
-		first_line.erase(0, 3);
-	}
+		vector<Point> reduced_points;
+		reduced_points.reserve(total_points);
+		vector<double> zeros(reduced_attr, 0.0);
+		for(int i = 0; i < total_points; i++)
+		{
+			reduced_points.push_back(Point(i, zeros));
+			reduced_points[i].setWeight(points[i].getWeight());
+		}
+		projection.apply(points, total_points, reduced_points);
 
-	cout << "Dataset info: " << first_line << endl;
+		KMeans reduced_kmeans(K, total_points, reduced_attr, max_iterations);
+		reduced_kmeans.setVerbose(false);
+		if(seeded)
+			reduced_kmeans.setSeed(nextRandom());
+		reduced_kmeans.setNearestEngine(nearest_engine);
+		reduced_kmeans.setPQRerankDepth(centroidPQ.getRerankDepth());
+		reduced_kmeans.run(reduced_points);
+		prestage_iterations = reduced_kmeans.getIterations();
 
-	// Use stringstream to split the first line into integers
-	stringstream ss(first_line);
-	int total_points, total_attr, K, max_iterations, has_name;
-	ss >> total_points >> total_attr >> K >> max_iterations >> has_name;
+		vector<int> labels(total_points);
+		for(int i = 0; i < total_points; i++)
+			labels[i] = reduced_points[i].getCluster();
+		seedFromLabels(points, labels);
+	}
 
-	if (total_points == 0 || total_attr == 0 || K == 0 || max_iterations == 0)
+	// Run the whole engine on a uniform random subsample and start the full run from its centroids
+	void runSubsampleStage(vector<Point> & points)
 	{
-		cout << "Invalid input" << endl;
-		return 1;
-	}
+		subsample_size = min(total_points, max(K, (int)(subsample_fraction * total_points)));
 
+		// Selection sampling (Knuth's algorithm S), keeps the input order
+		mt19937 sample_gen(nextRandom()); // Random seed is defined in main (or setSeed)
+		uniform_real_distribution<double> uniform(0.0, 1.0);
+		vector<Point> sample;
+		sample.reserve(subsample_size);
+		for(int i = 0; i < total_points && (int)sample.size() < subsample_size; i++)
+		{
+			if((total_points - i) * uniform(sample_gen) < subsample_size - (int)sample.size())
+				sample.push_back(points[i]);
+		}
 
+		KMeans sample_kmeans(K, subsample_size, total_attr, max_iterations);
+		sample_kmeans.setVerbose(false);
+		if(seeded)
+			sample_kmeans.setSeed(nextRandom());
+		sample_kmeans.setNearestEngine(nearest_engine);
+		sample_kmeans.setPQRerankDepth(centroidPQ.getRerankDepth());
+		sample_kmeans.run(sample);
+		prestage_iterations = sample_kmeans.getIterations();
 
-	vector<Point> points;
-	string point_name;
+		centralValues = sample_kmeans.getCentralValues(); // points stay unassigned, clusterCounts stay 0
+	}
 
-	for(int i = 0; i < total_points; i++)
+	void updateCentroid(int i)
 	{
-		vector<double> values;
-
-		for(int j = 0; j < total_attr; j++)
-		{
-			double value;
-			cin >> value;
-			values.push_back(value);
+		if(clusterCounts[i] > 0) {
+			double* cent_vals = &centralValues[getClusterIndex(i, 0)];
+			double* sums = &attributeSums[getClusterIndex(i, 0)];
+			#pragma omp simd
+			for(int j = 0; j < total_attr; j++) {
+				cent_vals[j] = sums[j] / clusterCounts[i];
+			}
+			Metric::finishCentroid(cent_vals, total_attr);
 		}
+	}
 
-		if(has_name)
+	// MEDIAN_UPDATE: every centroid attribute becomes the weighted median of that attribute over the cluster
+	void updateMedians(vector<Point> & points)
+	{
+		// Members of every cluster, collected in parallel (the order within a cluster doesn't change the median)
+		tbb::enumerable_thread_specific<vector<vector<int>>> thread_local_members(
+			[&]() { return vector<vector<int>>(K); }
+		);
+		tbb::parallel_for(tbb::blocked_range<int>(0, total_points), [&](const tbb::blocked_range<int>& r) {
+			auto& local_members = thread_local_members.local();
+			for(int i = r.begin(); i < r.end(); i++)
+				local_members[labelOf(points, i)].push_back(i);
+		});
+		vector<vector<int>> members(K);
+		vector<long long> member_weights(K, 0);
+		tbb::parallel_for(0, K, 1, [&](int c) {
+			for(const auto& local_members : thread_local_members)
+				members[c].insert(members[c].end(), local_members[c].begin(), local_members[c].end());
+			for(int m : members[c])
+				member_weights[c] += points[m].getWeight();
+		});
+
+		// One task per (cluster, attribute), so a small K still spreads over the threads
+		tbb::enumerable_thread_specific<vector<pair<double, long long>>> thread_local_columns;
+		tbb::parallel_for(0, K * total_attr, 1, [&](int index) {
+			int c = index / total_attr, j = index % total_attr;
+			if(members[c].empty())
+				return;
+			auto& column = thread_local_columns.local();
+			column.resize(members[c].size());
+			for(size_t m = 0; m < members[c].size(); m++)
+				column[m] = make_pair(points[members[c][m]].getValue(j), points[members[c][m]].getWeight());
+			centralValues[getClusterIndex(c, j)] = weightedMedian(column, member_weights[c]);
+		});
+	}
+
+	// Smallest value whose cumulative weight (values in ascending order) reaches half of total_weight, by
+	// quickselect instead of a full sort: nth_element halves the range that can still hold it, the weight
+	// left of the split decides which half. Unit weights are a single nth_element. Reorders column.
+	static double weightedMedian(vector<pair<double, long long>>& column, long long total_weight)
+	{
+		if(total_weight == (long long)column.size())
 		{
-			cin >> point_name;
-			Point p(i, values, point_name);
-			points.push_back(p);
+			auto median = column.begin() + (column.size() - 1) / 2;
+			nth_element(column.begin(), median, column.end());
+			return median->first;
 		}
-		else
+		size_t lo = 0, hi = column.size(); // the median is in [lo, hi)
+		long long below = 0;               // weight of [0, lo)
+		while(hi - lo > 1)
 		{
-			Point p(i, values);
-			points.push_back(p);
+			size_t mid = lo + (hi - lo) / 2;
+			nth_element(column.begin() + lo, column.begin() + mid, column.begin() + hi);
+			long long left = below;
+			for(size_t m = lo; m < mid; m++)
+				left += column[m].second;
+			if(2 * left >= total_weight)
+				hi = mid;
+			else
+			{
+				below = left;
+				lo = mid;
+			}
 		}
+		return column[lo].first;
+	}
+
+	string engineName(NearestEngine engine)
+	{
+		if(engine == NEAREST_BALLTREE)
+			return "ball tree";
+		if(engine == NEAREST_PQ)
+			return "product quantization (M = " + to_string(centroidPQ.getSubspaces()) + ", rerank depth = " + to_string(centroidPQ.getRerankDepth()) + ")";
+		return "linear scan";
+	}
+
+public:
+	KMeans(int K, int total_points, int total_attr, int max_iterations)
+	{
+		this->K = K;
+		this->total_points = total_points;
+		this->total_attr = total_attr;
+		this->max_iterations = max_iterations;
+		
+		// Initialize vectors with correct sizes
+		centralValues.resize(K * total_attr);
+		attributeSums.resize(K * total_attr);
+		clusterCounts.resize(K);
+	}
+
+	void setNearestEngine(NearestEngine engine)
+	{
+		nearest_engine = engine;
+	}
 
-		// Clear any remaining values in the line
-		cin.ignore(numeric_limits<streamsize>::max(), '\n');
+	// Candidates re-ranked with the exact distance in NEAREST_PQ mode (higher = better recall, slower)
+	void setPQRerankDepth(int depth)
+	{
+		centroidPQ.setRerankDepth(depth);
 	}
 
-	vector<Point> backup_points = points; // make a backup copy
+	void setPQSubspaces(int M)
+	{
+		centroidPQ.setSubspaces(M);
+	}
 
-	// for (int threads : {1, 2, 4, 8, 16, 32, 50, 100, 500}) {
-	// 	tbb::global_control c(tbb::global_control::max_allowed_parallelism, threads);
-		srand (123); // For reproducibility
+	void setSeed(unsigned int seed)
+	{
+		seeded = true;
+		gen.seed(seed);
+	}
 
-		points = backup_points; // restore the backup copy
+	// The draws rand() would make after srand(seed), without touching the global generator: same results as
+	// srand(seed) + run(), also with other runs going on in parallel
+	void setRandSeed(unsigned int seed)
+	{
+		rand_sequence = make_shared<RunRandom>(seed);
+	}
 
-		// cout << "Threads: " << threads << endl;
-		KMeans kmeans(K, total_points, total_attr, max_iterations);
-		kmeans.run(points);
-	// }
+	// Sum of squared distances (times weights) from every point to its nearest centroid
+	double computeInertia(vector<Point> & points)
+	{
+		prepareModel();
+		return tbb::parallel_reduce(tbb::blocked_range<int>(0, (int)points.size()), 0.0,
+			[&](const tbb::blocked_range<int>& r, double sum) {
+				for(int i = r.begin(); i < r.end(); i++)
+				{
+					double* p_vals = points[i].getValues().data();
+					int c = findNearestCentroid(p_vals);
+					sum += points[i].getWeight() * Metric::distance(&centralValues[getClusterIndex(c, 0)], p_vals, total_attr);
+				}
+				return sum;
+			}, plus<double>());
+	}
 
-	return 0;
-}
+	// Keep the cluster of every point in labels (total_points entries, filled by run()) instead of in the points,
+	// so concurrent runs can share one points vector
+	void setLabelArray(vector<int>* labels)
+	{
+		label_array = labels;
+	}
 
+	void setVerbose(bool verbose)
+	{
+		this->verbose = verbose;
+	}
 
+	// Start from these centroids (K * total_attr) instead of K random points.
+	// seed_us is the time it took to compute them; it is added to the reported TOTAL and PHASE 1.
+	void setInitialCentroids(const vector<double>& centroids, long long seed_us = 0)
+	{
+		initial_centroids = centroids;
+		this->seed_us = seed_us;
+	}
+
+	// Run Lloyd in a reduced_attr dimensional projection first, then at most refine_iterations in full space
+	void setReduction(ReductionMethod method, int reduced_attr, int refine_iterations)
+	{
+		this->reduction_method = method;
+		this->reduced_attr = reduced_attr;
+		this->refine_iterations = refine_iterations;
+	}
+
+	// Warm start from a run on this fraction of the points (at least K of them)
+	void setSubsample(double fraction)
+	{
+		subsample_fraction = fraction;
+	}
+
+	// Points were deduplicated: source_rows[r] is the point that input row r was collapsed into.
+	// Initialization then draws from the original rows, so the result matches the un-deduplicated run.
+	void setSourceRows(const vector<int>& source_rows)
+	{
+		this->source_rows = source_rows;
+	}
+
+	// ======================= ONLINE UPDATES ======================= //
+	// After run(), the model is centralValues plus the per-cluster clusterCounts / attributeSums of everything it
+	// has seen. ingest() folds a new batch into that state without revisiting old data:
+	//  1. assign the batch in parallel and add it to the counts/sums; only clusters that received points move
+	//  2. up to max_refine_iterations passes re-assigning just the batch points, moving their contribution
+	//     between clusters and re-centering only the clusters touched so far; stops when nothing moves
+	// Old points are never re-assigned (they are not kept), so this is an approximation of re-running on all data.
+	// Returns the number of refinement passes done.
+	int ingest(vector<Point> & batch, int max_refine_iterations)
+	{
+		int batch_size = batch.size();
+		active_engine = chooseNearestEngine();
+		vector<char> touched(K, 0);
+
+		int refine = 0;
+		for(bool moved = true; moved && refine <= max_refine_iterations; refine++)
+		{
+			buildCentroidIndex();
+			tbb::enumerable_thread_specific<vector<long long>> thread_local_point_diffs(
+				[&]() { return vector<long long>(K, 0); }
+			);
+			tbb::enumerable_thread_specific<vector<double>> thread_local_sum_diffs(
+				[&]() { return vector<double>(K * total_attr, 0.0); }
+			);
+
+			tbb::parallel_for(0, batch_size, 1, [&](int i) {
+				int id_old_cluster = batch[i].getCluster();
+				int id_nearest_center = findNearestCluster(batch[i]);
+				if(id_old_cluster == id_nearest_center)
+					return;
+
+				auto& local_diffs = thread_local_point_diffs.local();
+				auto& local_sums = thread_local_sum_diffs.local();
+				double weight = batch[i].getWeight();
+				double* p_vals = batch[i].getValues().data();
+				if(id_old_cluster != -1)
+				{
+					local_diffs[id_old_cluster] -= batch[i].getWeight();
+					double* sums = &local_sums[getClusterIndex(id_old_cluster, 0)];
+					#pragma omp simd
+					for(int j = 0; j < total_attr; j++)
+						sums[j] -= weight * p_vals[j];
+				}
+				local_diffs[id_nearest_center] += batch[i].getWeight();
+				double* sums = &local_sums[getClusterIndex(id_nearest_center, 0)];
+				#pragma omp simd
+				for(int j = 0; j < total_attr; j++)
+					sums[j] += weight * p_vals[j];
+				batch[i].setCluster(id_nearest_center);
+			});
+
+			moved = false;
+			vector<char> changed(K, 0);
+			for (const auto& local_diffs : thread_local_point_diffs)
+				for (int i = 0; i < K; i++)
+					if (local_diffs[i] != 0) {
+						clusterCounts[i] += local_diffs[i];
+						changed[i] = touched[i] = 1;
+					}
+			for (const auto& local_sums : thread_local_sum_diffs)
+				for (int j = 0; j < K * total_attr; j++)
+					attributeSums[j] += local_sums[j];
+
+			vector<int> recenter;
+			for(int i = 0; i < K; i++)
+				if(changed[i])
+					recenter.push_back(i);
+			moved = !recenter.empty();
+			tbb::parallel_for(0, (int)recenter.size(), 1, [&](int r) {
+				updateCentroid(recenter[r]);
+			});
+		}
+
+		touched_clusters = count(touched.begin(), touched.end(), 1);
+		return refine - 1;
+	}
+
+	// Clusters whose centroid moved during the last ingest()
+	int getTouchedClusters()
+	{
+		return touched_clusters;
+	}
+
+	vector<long long>& getClusterCounts()
+	{
+		return clusterCounts;
+	}
+
+	// Per-cluster sums of the points behind each centroid (K * total_attr)
+	vector<double>& getAttributeSums()
+	{
+		return attributeSums;
+	}
+
+	// ======================= MODEL / PREDICT ======================= //
+	void setModelOutput(const string& path, ModelDType dtype)
+	{
+		model_path = path;
+		model_dtype = dtype;
+	}
+
+	KMeansModel getModel()
+	{
+		KMeansModel model;
+		model.K = K;
+		model.total_attr = total_attr;
+		model.centroids = centralValues;
+		computeModelNorms(model);
+		model.scaling = scaling;
+		return model;
+	}
+
+	// Load trained centroids (model.K and model.total_attr must match this KMeans)
+	void setModel(const KMeansModel& model)
+	{
+		centralValues = model.centroids;
+		scaling = model.scaling;
+	}
+
+	// Run the Lloyd iterations on this quantized copy of the points (same order as the points given to run()).
+	// The Point values are still used for initialization and for the floating point rechecks.
+	void setQuantizedPoints(const QuantizedPoints* quantized)
+	{
+		this->quantized = quantized;
+	}
+
+	// Diffs + attribute sums one thread keeps in the Lloyd loop
+	size_t accumulatorBytesPerThread()
+	{
+		return heapBlockBytes(K * sizeof(long long)) + heapBlockBytes(K * sizeof(vector<double>))
+			+ K * heapBlockBytes(total_attr * sizeof(double));
+	}
+
+	// Centroids, sums, counts and the index the active engine searches
+	size_t modelBytes(NearestEngine engine)
+	{
+		size_t centroid_bytes = heapBlockBytes((size_t)K * total_attr * sizeof(double));
+		size_t bytes = 2 * centroid_bytes + heapBlockBytes(K * sizeof(long long));
+		if(engine == NEAREST_BALLTREE)
+			bytes += CentroidBallTree::memoryBytes(K, total_attr);
+		else if(engine == NEAREST_PQ)
+			bytes += CentroidProductQuantizer::memoryBytes(K, total_attr);
+		return bytes;
+	}
+
+	// What the structures of the last run() over these points take
+	MemoryFootprint measureMemory(vector<Point> & points)
+	{
+		MemoryFootprint footprint;
+		footprint.dataset = vectorHeapBytes(points) + tbb::parallel_reduce(tbb::blocked_range<size_t>(0, points.size()), (size_t)0,
+			[&](const tbb::blocked_range<size_t>& r, size_t bytes) {
+				for(size_t i = r.begin(); i < r.end(); i++)
+					bytes += points[i].heapBytes();
+				return bytes;
+			}, plus<size_t>());
+		if(quantized != nullptr)
+			footprint.dataset += heapBlockBytes(quantized->bytesPerPoint() * total_points);
+		footprint.labels = vectorHeapBytes(quantizedLabels) + vectorHeapBytes(source_rows);
+		footprint.accumulators = accumulator_bytes;
+		footprint.model = modelBytes(active_engine);
+		return footprint;
+	}
+
+	// The same items predicted from N, D, K, the engine and the thread count, before anything is loaded.
+	// Names are assumed short (no heap), vector<Point> exactly sized. The loaders fill the points in place, the
+	// only other buffer is one chunk of lines of the --scale text loader (LOAD_CHUNK_LINES, independent of N).
+	MemoryFootprint estimateMemory(int threads, int quantize_bits, bool dedupe)
+	{
+		MemoryFootprint footprint;
+		footprint.dataset = (size_t)total_points * (sizeof(Point) + heapBlockBytes(total_attr * sizeof(double)));
+		if(quantize_bits != 0)
+		{
+			size_t stride = (total_attr + 15) / 16 * 16;
+			footprint.dataset += heapBlockBytes((size_t)total_points * (stride * quantize_bits / 8 + sizeof(int64_t)));
+			footprint.labels += (size_t)total_points * sizeof(int);
+		}
+		if(dedupe)
+			footprint.labels += (size_t)total_points * sizeof(int);
+		footprint.accumulators = threads * (quantize_bits != 0
+			? heapBlockBytes(K * sizeof(long long)) + heapBlockBytes((size_t)K * total_attr * sizeof(int64_t)) // assignQuantized
+			: accumulatorBytesPerThread());
+		footprint.model = modelBytes(chooseNearestEngine());
+		return footprint;
+	}
+
+	void printMemoryEstimate(int threads, int quantize_bits, bool dedupe)
+	{
+		MemoryFootprint footprint = estimateMemory(threads, quantize_bits, dedupe);
+		double raw_bytes = (double)total_points * total_attr * sizeof(double);
+		cout << "Nearest centroid search: " << engineName(chooseNearestEngine()) << ", " << threads << " threads\n";
+		footprint.print(cout, "Estimated memory");
+		cout << "Raw data: " << raw_bytes / 1e6 << " MB (estimate is " << footprint.total() / raw_bytes << "x)" << endl;
+	}
+
+	// Record phase timings, moved points, centroid shift and inertia of every dense Lloyd iteration of run().
+	// The quantized and sparse paths are not instrumented.
+	void setTrace(IterationTrace* trace)
+	{
+		this->trace = trace;
+	}
+
+	// Report iteration, moved points and inertia after every dense Lloyd iteration of run() (same coverage as
+	// setTrace); returning false ends run() after that iteration
+	void setProgress(function<bool(const KMeansProgress&)> progress)
+	{
+		this->progress = progress;
+	}
+
+	bool isCancelled()
+	{
+		return cancelled;
+	}
+
+	// Count cycles, instructions and LLC misses per phase/worker of the dense Lloyd iterations of run()
+	void setCounters(PhaseCounters* counters)
+	{
+		this->counters = counters;
+	}
+
+	// The points given to run() went through this scaling (the model keeps it, printCentroids undoes it)
+	void setScaling(const FeatureScaling& scaling)
+	{
+		this->scaling = scaling;
+	}
+
+	// Nearest centroid for every point, through the same parallel kernel/engine as run()
+	void predict(vector<Point> & points, vector<int>& labels)
+	{
+		int count = points.size();
+		labels.resize(count);
+		prepareModel();
+		tbb::parallel_for(tbb::blocked_range<int>(0, count), [&](const tbb::blocked_range<int>& r) {
+			for(int i = r.begin(); i < r.end(); i++)
+				labels[i] = findNearestCluster(points[i]);
+		});
+	}
+
+	// Pick the engine and build its index once for the loaded model (before assignRows)
+	void prepareModel()
+	{
+		active_engine = chooseNearestEngine();
+		buildCentroidIndex();
+	}
+
+	// Same as predict on count contiguous rows (count * total_attr). Small batches stay on the calling thread.
+	void assignRows(const double* rows, int count, int* labels)
+	{
+		const int GRAIN = 64;
+		tbb::parallel_for(tbb::blocked_range<int>(0, count, GRAIN), [&](const tbb::blocked_range<int>& r) {
+			for(int i = r.begin(); i < r.end(); i++)
+				labels[i] = findNearestCentroid(rows + (size_t)i * total_attr);
+		});
+	}
+
+	void printCentroids()
+	{
+		vector<double> centroid(total_attr);
+		for(int i = 0; i < K; i++)
+		{
+			cout << "Cluster " << i + 1 << ": ";
+			copy(&centralValues[getClusterIndex(i, 0)], &centralValues[getClusterIndex(i, 0)] + total_attr, centroid.begin());
+			if(scaling.enabled())
+				scaling.unapply(centroid.data());
+			for(int j = 0; j < total_attr; j++)
+				cout << centroid[j] << " ";
+			cout << "\n\n";
+		}
+	}
+
+	vector<double>& getCentralValues()
+	{
+		return centralValues;
+	}
+
+	// Unscaled copy (libkmeans.h)
+	vector<double> getCentroids()
+	{
+		vector<double> centroids = centralValues;
+		if(scaling.enabled())
+			for(int i = 0; i < K; i++)
+				scaling.unapply(&centroids[getClusterIndex(i, 0)]);
+		return centroids;
+	}
+
+	long long getTotalTime()
+	{
+		return total_us;
+	}
+
+	long long getInitTime()
+	{
+		return init_us;
+	}
+
+	int getIterations()
+	{
+		return iterations;
+	}
+
+	void initializeClusterCentroids(vector<Point> & points)
+	{
+		if(!source_rows.empty())
+		{
+			initializeFromSourceRows(points);
+			return;
+		}
+
+		// Manually initialize K cluster centroids with unique, random points
+		vector<int> prohibited_indexes;
+		for(int i = 0; i < K; i++)
+		{
+			while(true)
+			{
+				int index_point = nextRandom() % total_points; // Random seed is defined in main (or setSeed)
+
+				if(find(prohibited_indexes.begin(), prohibited_indexes.end(),
+						index_point) == prohibited_indexes.end())
+				{
+					prohibited_indexes.push_back(index_point);
+					setLabel(points, index_point, i);
+					clusterCounts[i] = points[index_point].getWeight();
+					
+					// Copy point values to central values
+					for(int j = 0; j < total_attr; j++) {
+						centralValues[getClusterIndex(i, j)] = points[index_point].getValue(j);
+					}
+					break;
+				}
+			}
+		}
+		return;
+	}
+
+	// Same random picks as initializeClusterCentroids would make on the un-deduplicated input, mapped to the
+	// weighted rows. The rows are left unassigned: a weighted row can't be partly in two clusters when two picks
+	// land on copies of the same row, and the first iteration assigns everything anyway.
+	void initializeFromSourceRows(vector<Point> & points)
+	{
+		int total_source_rows = source_rows.size();
+		vector<int> prohibited_indexes;
+		for(int i = 0; i < K; i++)
+		{
+			while(true)
+			{
+				int index_point = nextRandom() % total_source_rows; // Random seed is defined in main (or setSeed)
+
+				if(find(prohibited_indexes.begin(), prohibited_indexes.end(),
+						index_point) == prohibited_indexes.end())
+				{
+					prohibited_indexes.push_back(index_point);
+					Point& point = points[source_rows[index_point]];
+					for(int j = 0; j < total_attr; j++) {
+						centralValues[getClusterIndex(i, j)] = point.getValue(j);
+					}
+					break;
+				}
+			}
+		}
+	}
+
+	// ======================= SPARSE INPUT ======================= //
+	// Lloyd on CSR points. Distances are ||x||^2 - 2 x.c + ||c||^2 with only the nonzeros of x touched: the
+	// centroids are transposed to attribute-major once per iteration so each nonzero updates all K dot products
+	// from one contiguous row (||x||^2 is the same for every centroid and is left out of the comparison).
+	// Sums scatter the nonzeros into the thread local K x total_attr sums, merged like P3.
+	void runSparse(const SparseMatrix& points, vector<int>& labels)
+	{
+		if(K > total_points)
+			return;
+
+		auto begin = chrono::high_resolution_clock::now();
+		labels.assign(total_points, -1);
+		fill(centralValues.begin(), centralValues.end(), 0.0);
+		vector<int> prohibited_indexes;
+		for(int i = 0; i < K; i++)
+		{
+			while(true)
+			{
+				int index_point = nextRandom() % total_points; // Random seed is defined in main (or setSeed)
+				if(find(prohibited_indexes.begin(), prohibited_indexes.end(), index_point) == prohibited_indexes.end())
+				{
+					prohibited_indexes.push_back(index_point);
+					labels[index_point] = i;
+					clusterCounts[i] = 1;
+					for(int64_t k = points.row_start[index_point]; k < points.row_start[index_point + 1]; k++)
+						centralValues[getClusterIndex(i, points.attr_index[k])] = points.values[k];
+					break;
+				}
+			}
+		}
+		auto end_phase1 = chrono::high_resolution_clock::now();
+
+		vector<double> centroids_by_attr((size_t)total_attr * K);
+		vector<double> centroid_norms(K);
+		// Allocated once per thread, cleared at the start of every iteration
+		tbb::enumerable_thread_specific<vector<long long>> thread_local_point_diffs(
+			[&]() { return vector<long long>(K, 0); }
+		);
+		tbb::enumerable_thread_specific<vector<double>> thread_local_attribute_sums(
+			[&]() { return vector<double>((size_t)K * total_attr, 0.0); }
+		);
+		tbb::enumerable_thread_specific<vector<double>> thread_local_dots(
+			[&]() { return vector<double>(K); }
+		);
+		int iter = 1;
+		bool done = false;
+		for(; !done && iter <= max_iterations; iter++)
+		{
+			done = true;
+			for(auto& local_diffs : thread_local_point_diffs)
+				fill(local_diffs.begin(), local_diffs.end(), 0);
+			for(auto& local_sums : thread_local_attribute_sums)
+				fill(local_sums.begin(), local_sums.end(), 0.0);
+			tbb::parallel_for(0, total_attr, 1, [&](int j) {
+				for(int i = 0; i < K; i++)
+					centroids_by_attr[(size_t)j * K + i] = centralValues[getClusterIndex(i, j)];
+			});
+			tbb::parallel_for(0, K, 1, [&](int i) {
+				const double* cent_vals = &centralValues[getClusterIndex(i, 0)];
+				double norm = 0.0;
+				for(int j = 0; j < total_attr; j++)
+					norm += cent_vals[j] * cent_vals[j];
+				centroid_norms[i] = norm;
+			});
+
+			// P1
+			tbb::parallel_for(tbb::blocked_range<int>(0, total_points), [&](const tbb::blocked_range<int>& r) {
+				auto& local_diffs = thread_local_point_diffs.local();
+				auto& local_sums = thread_local_attribute_sums.local();
+				auto& dots = thread_local_dots.local();
+				for(int p = r.begin(); p < r.end(); p++)
+				{
+					int64_t row_begin = points.row_start[p], row_end = points.row_start[p + 1];
+					fill(dots.begin(), dots.end(), 0.0);
+					for(int64_t k = row_begin; k < row_end; k++)
+					{
+						double v = points.values[k];
+						const double* column = &centroids_by_attr[(size_t)points.attr_index[k] * K];
+						#pragma omp simd
+						for(int i = 0; i < K; i++)
+							dots[i] += v * column[i];
+					}
+
+					int id_nearest_center = 0;
+					double min_dist = centroid_norms[0] - 2 * dots[0];
+					for(int i = 1; i < K; i++)
+					{
+						double dist = centroid_norms[i] - 2 * dots[i];
+						if(dist < min_dist)
+						{
+							min_dist = dist;
+							id_nearest_center = i;
+						}
+					}
+
+					// P3
+					if(labels[p] != id_nearest_center)
+					{
+						if(labels[p] != -1)
+							local_diffs[labels[p]]--;
+						local_diffs[id_nearest_center]++;
+						labels[p] = id_nearest_center;
+					}
+					double* sums = &local_sums[getClusterIndex(id_nearest_center, 0)];
+					for(int64_t k = row_begin; k < row_end; k++)
+						sums[points.attr_index[k]] += points.values[k];
+				}
+			});
+
+			// P3
+			for(const auto& local_diffs : thread_local_point_diffs)
+				for(int i = 0; i < K; i++)
+				{
+					if(done && local_diffs[i] != 0)
+						done = false;
+					clusterCounts[i] += local_diffs[i];
+				}
+			tbb::parallel_for(0, K, 1, [&](int i) {
+				double* sums = &attributeSums[getClusterIndex(i, 0)];
+				fill(sums, sums + total_attr, 0.0);
+				for(const auto& local_sums : thread_local_attribute_sums)
+				{
+					const double* local = &local_sums[getClusterIndex(i, 0)];
+					#pragma omp simd
+					for(int j = 0; j < total_attr; j++)
+						sums[j] += local[j];
+				}
+			});
+
+			// P2
+			tbb::parallel_for(0, K, 1, [&](int i) {
+				updateCentroid(i);
+			});
+		}
+
+		auto end = chrono::high_resolution_clock::now();
+		iterations = iter - 1;
+		if(!model_path.empty() && writeModel(model_path, getModel(), model_dtype) && verbose)
+			cout << "Model written to " << model_path << "\n";
+		if(!verbose)
+			return;
+
+		cout << "Break in iteration " << iterations << "\n\n";
+		printSparseCentroids(10);
+		cout << "TOTAL EXECUTION TIME = "<<chrono::duration_cast<chrono::microseconds>(end-begin).count()<<"μs\n";
+		cout << "TIME PHASE 1 = "<<chrono::duration_cast<chrono::microseconds>(end_phase1-begin).count()<<"μs\n";
+		cout << "TIME PHASE 2 = "<<chrono::duration_cast<chrono::microseconds>(end-end_phase1).count()<<"μs\n" << endl;
+		cout << "AV TIME PER ITERATION = " << (chrono::duration_cast<chrono::microseconds>(end-begin).count() / max(1, iterations)) << "μs\n\n\n" << endl;
+	}
+
+	// Wide centroids are summarized: size and the 'top' largest attributes (index:value) of each
+	void printSparseCentroids(int top)
+	{
+		vector<int> order(total_attr);
+		for(int i = 0; i < K; i++)
+		{
+			const double* cent_vals = &centralValues[getClusterIndex(i, 0)];
+			iota(order.begin(), order.end(), 0);
+			int shown = min(top, total_attr);
+			partial_sort(order.begin(), order.begin() + shown, order.end(), [&](int a, int b) {
+				return cent_vals[a] > cent_vals[b] || (cent_vals[a] == cent_vals[b] && a < b);
+			});
+			cout << "Cluster " << i + 1 << " (" << clusterCounts[i] << " points): ";
+			for(int s = 0; s < shown && cent_vals[order[s]] != 0.0; s++)
+				cout << order[s] << ":" << cent_vals[order[s]] << " ";
+			cout << "\n\n";
+		}
+	}
+
+	void run(vector<Point> & points)
+	{
+		if(K > total_points)
+			return;
+
+        auto begin = chrono::high_resolution_clock::now();
+		if(label_array != nullptr)
+			label_array->assign(total_points, -1);
+		accumulator_bytes = 0;
+		if(Metric::PREPARES_POINTS)
+			tbb::parallel_for(0, total_points, 1, [&](int i) {
+				Metric::prepare(points[i].getValues().data(), total_attr);
+			});
+		int iteration_limit = max_iterations;
+		bool use_reduction = reduced_attr > 0 && reduced_attr < total_attr;
+		bool use_subsample = !use_reduction && subsample_fraction > 0.0;
+		if(use_reduction)
+		{
+			runReducedSpaceStage(points);
+			iteration_limit = refine_iterations;
+		}
+		else if(use_subsample)
+			runSubsampleStage(points);
+		else if(!initial_centroids.empty())
+			centralValues = initial_centroids; // points stay unassigned, clusterCounts stay 0
+		else
+			initializeClusterCentroids(points);
+        auto end_phase1 = chrono::high_resolution_clock::now();
+
+		active_engine = chooseNearestEngine();
+		if(quantized != nullptr)
+		{
+			quantizedLabels.resize(total_points);
+			for(int i = 0; i < total_points; i++)
+				quantizedLabels[i] = labelOf(points, i);
+			quantized_rechecks = 0;
+		}
+
+		// ======================= RUN KMEANS ======================= //
+		int iter = 1;
+		bool done = false;
+		IterationRecord record;
+		vector<double> previous_centroids;
+		tbb::enumerable_thread_specific<pair<long long, double>> thread_local_progress; // moved, inertia (traced only)
+		bool tracked = trace != nullptr || progress; // thread_local_progress is filled
+		cancelled = false;
+		PhaseMark counted_phase;
+		// Work per phase for the roofline: FLOPs of the distance kernel are only known for the linear scan
+		double point_bytes = (double)total_points * total_attr * sizeof(double);
+		double centroid_bytes = (double)K * total_attr * sizeof(double);
+		double assign_flops = (double)total_points * total_attr * (active_engine == NEAREST_LINEAR ? 3.0 * K + 2.0 : 2.0);
+		for (; !done && iter <= iteration_limit; iter++)
+		{
+			done = true;
+			double phase_begin = trace != nullptr ? trace->now() : 0.0;
+			if(counters != nullptr)
+				counted_phase = counters->mark();
+			buildCentroidIndex();
+			if(counters != nullptr && quantized == nullptr)
+			{
+				counters->endSerial(PHASE_INDEX, counted_phase, 0.0, centroid_bytes);
+				counted_phase = counters->mark();
+			}
+			if(tracked)
+				for(auto& local : thread_local_progress)
+					local = { 0, 0.0 };
+			if(trace != nullptr)
+			{
+				record = { iter, trace->span("index", iter, phase_begin) - phase_begin, 0.0, 0.0, 0.0, 0, 0.0, 0.0 };
+				phase_begin = trace->now();
+			}
+
+			// Cleared here rather than after the update so the last iteration's sums stay around as part of the
+			// trained model (see ingest)
+			fill(attributeSums.begin(), attributeSums.end(), 0.0);
+
+			if(quantized != nullptr)
+			{
+				done = assignQuantized(points);
+				tbb::parallel_for(0, K, 1, [&](int i) {
+					updateCentroid(i);
+				});
+				continue;
+			}
+
+			tbb::enumerable_thread_specific<vector<long long>> thread_local_point_diffs(
+				[&]() { return vector<long long>(K, 0); }
+			); // Basically, this creates a vector of size K with all elements initialized to 0 per thread
+			tbb::enumerable_thread_specific<vector<vector<double>>> thread_local_attribute_sums(
+				[&]() { return vector<vector<double>>(K, vector<double>(total_attr, 0.0)); }
+			); // 2-D vector, K x total_attr: Rows are clusters, columns are attributes
+
+			// P1. Parallel for over all points to assign them to the nearest cluster
+			tbb::parallel_for(tbb::blocked_range<int>(0, total_points), [&](const tbb::blocked_range<int>& r) {
+				double span_begin = trace != nullptr ? trace->now() : 0.0;
+				CounterSample task_counters = counters != nullptr ? counters->sample() : CounterSample();
+				long long moved = 0;
+				double inertia = 0.0;
+				for(int i = r.begin(); i < r.end(); i++)
+				{
+					// NOTE: Due to the nature of findNearestCluster, cluster information should NOT be changed in this loop
+					int id_old_cluster = labelOf(points, i);
+					double min_dist;
+					int id_nearest_center = findNearestCluster(points[i], min_dist);
+
+					double weight = points[i].getWeight();
+					if(tracked)
+						inertia += weight * min_dist;
+
+					if(id_old_cluster != id_nearest_center)
+					{
+						// P3
+						auto& local_diffs = thread_local_point_diffs.local();
+						if (id_old_cluster != -1) {
+							local_diffs[id_old_cluster] -= points[i].getWeight();
+						}
+						local_diffs[id_nearest_center] += points[i].getWeight();
+
+						setLabel(points, i, id_nearest_center);
+						moved++;
+					}
+
+					// P3
+					auto& local_sums = thread_local_attribute_sums.local();
+					addWeighted(local_sums[id_nearest_center].data(), points[i].getValues().data(), weight, total_attr);
+				}
+				if(tracked)
+				{
+					auto& local = thread_local_progress.local();
+					local.first += moved;
+					local.second += inertia;
+				}
+				if(trace != nullptr)
+					trace->span("assign", iter, span_begin);
+				if(counters != nullptr)
+					counters->add(PHASE_ASSIGN, task_counters);
+			});
+			if(counters != nullptr)
+			{
+				counters->endParallel(PHASE_ASSIGN, counted_phase, assign_flops, point_bytes);
+				counted_phase = counters->mark();
+			}
+			if(trace != nullptr)
+			{
+				record.assign_us = trace->now() - phase_begin;
+				for(const auto& local : thread_local_progress)
+				{
+					record.moved += local.first;
+					record.inertia += local.second;
+				}
+				phase_begin = trace->now();
+			}
+
+			// P3. Updating num_points using the values of the differences accumulated in each threadLocalPointDiffs
+			for (const auto& local_diffs : thread_local_point_diffs) {
+				for (int i = 0; i < K; i++) {
+					if (done && local_diffs[i] != 0) { // Moved 'done' check here to remove race condition/contention
+						done = false;
+					}
+					clusterCounts[i] += local_diffs[i];
+				}
+			}
+
+			accumulator_bytes = max(accumulator_bytes, thread_local_attribute_sums.size() * accumulatorBytesPerThread());
+
+			// P3. Update attribute sums
+			for (const auto& local_sums : thread_local_attribute_sums) {
+				for (int i = 0; i < K; i++) {
+					double* sums = &attributeSums[getClusterIndex(i, 0)];
+					#pragma omp simd
+					for (int j = 0; j < total_attr; j++) {
+						sums[j] += local_sums[i][j];
+					}
+				}
+			}
+
+			if(counters != nullptr)
+			{
+				double merged = thread_local_attribute_sums.size() * (double)K * total_attr;
+				counters->endSerial(PHASE_REDUCE, counted_phase, merged, merged * sizeof(double));
+			}
+			if(trace != nullptr)
+			{
+				record.reduce_us = trace->span("reduce", iter, phase_begin) - phase_begin;
+				previous_centroids = centralValues;
+				phase_begin = trace->now();
+			}
+
+			// P2. parallel centroid update
+			if(Metric::MEDIAN_UPDATE)
+				updateMedians(points);
+			else
+			{
+				if(counters != nullptr)
+					counted_phase = counters->mark();
+				tbb::parallel_for(tbb::blocked_range<int>(0, K), [&](const tbb::blocked_range<int>& r) {
+					double span_begin = trace != nullptr ? trace->now() : 0.0;
+					CounterSample task_counters = counters != nullptr ? counters->sample() : CounterSample();
+					for(int i = r.begin(); i < r.end(); i++)
+						updateCentroid(i);
+					if(trace != nullptr)
+						trace->span("update", iter, span_begin);
+					if(counters != nullptr)
+						counters->add(PHASE_UPDATE, task_counters);
+				});
+				if(counters != nullptr)
+					counters->endParallel(PHASE_UPDATE, counted_phase, centroid_bytes / sizeof(double), 2.0 * centroid_bytes);
+			}
+
+			if(trace != nullptr)
+			{
+				record.update_us = trace->now() - phase_begin;
+				for(int i = 0; i < K; i++)
+				{
+					double shift = squaredDistance(&previous_centroids[getClusterIndex(i, 0)], &centralValues[getClusterIndex(i, 0)], total_attr);
+					record.max_shift = max(record.max_shift, sqrt(shift));
+				}
+				trace->addIteration(record);
+			}
+
+			if(progress)
+			{
+				KMeansProgress state = { iter, 0, 0.0 };
+				for(const auto& local : thread_local_progress)
+				{
+					state.changed += local.first;
+					state.inertia += local.second;
+				}
+				if(!progress(state) && !done)
+					done = cancelled = true; // iter still counts this pass
+			}
+		}
+
+		if(iter == 1)
+		{
+			// No pass was allowed (max_iterations = 0, e.g. --bisect-refine=0): still label every point
+			// with its nearest centroid so the result and --labels-out are complete
+			buildCentroidIndex();
+			tbb::parallel_for(tbb::blocked_range<int>(0, total_points), [&](const tbb::blocked_range<int>& r) {
+				for(int i = r.begin(); i < r.end(); i++)
+				{
+					int c = findNearestCluster(points[i]);
+					setLabel(points, i, c);
+					if(quantized != nullptr)
+						quantizedLabels[i] = c;
+				}
+			});
+			fill(clusterCounts.begin(), clusterCounts.end(), 0);
+			for(int i = 0; i < total_points; i++)
+				clusterCounts[labelOf(points, i)] += points[i].getWeight();
+		}
+
+        auto end = chrono::high_resolution_clock::now();
+		iterations = iter - 1;
+		total_us = chrono::duration_cast<chrono::microseconds>(end-begin).count() + seed_us;
+		init_us = chrono::duration_cast<chrono::microseconds>(end_phase1-begin).count() + seed_us;
+		if(quantized != nullptr)
+			tbb::parallel_for(0, total_points, 1, [&](int i) {
+				setLabel(points, i, quantizedLabels[i]);
+			});
+		if(!model_path.empty() && writeModel(model_path, getModel(), model_dtype) && verbose)
+			cout << "Model written to " << model_path << "\n";
+		if(!verbose)
+			return;
+
+		if(use_reduction)
+			cout << "Reduced-space pre-stage: " << (reduction_method == REDUCE_PCA ? "PCA" : "random projection")
+				<< " to " << reduced_attr << " attributes, " << prestage_iterations << " iterations\n";
+		if(use_subsample)
+			cout << "Subsample pre-stage: " << subsample_size << " of " << total_points << " points, "
+				<< prestage_iterations << " iterations\n";
+		if(!is_same<Metric, SquaredL2>::value)
+			cout << "Distance: " << Metric::name() << "\n";
+		cout << "Nearest centroid search: " << engineName(active_engine) << "\n";
+		if(quantized != nullptr)
+			cout << "Quantized points: int" << quantized->getBits() << " (step " << quantized->getStep() << "), "
+				<< quantized->bytesPerPoint() << " bytes read per point instead of " << total_attr * sizeof(double)
+				<< ", " << quantized_rechecks << " assignments rechecked in floating point\n";
+		if(quantized != nullptr && 4 * quantized_rechecks > (long long)total_points * max(1, iterations))
+			cout << "Warning: over a quarter of the assignments needed the floating point recheck, the grid is too coarse"
+				<< " for this data (scale it first with --scale=zscore|minmax, or use --quantize=int16)\n";
+		if(active_engine == NEAREST_PQ)
+			cout << "PQ LABEL MISMATCH VS EXACT = " << 100.0 * labelMismatchRate(points) << "%\n";
+		measureMemory(points).print(cout, "Memory");
+		cout << "Peak RSS: " << peakRssBytes() / 1e6 << " MB\n";
+		cout << "Break in iteration " << iterations << "\n";
+		if(iterations == 0)
+			cout << "(no iteration allowed, every point was assigned to its nearest initial centroid)\n";
+		cout << "\n";
+
+		printCentroids();
+		cout << "TOTAL EXECUTION TIME = "<<total_us<<"μs\n";
+		cout << "TIME PHASE 1 = "<<init_us<<"μs\n";
+		if(seed_us > 0)
+			cout << "(PHASE 1 includes " << seed_us << "μs computing the initial centroids)\n";
+		if(use_reduction)
+			cout << "(PHASE 1 is the reduced-space pre-stage, PHASE 2 the full-space refinement)\n";
+		if(use_subsample)
+			cout << "(PHASE 1 is the subsample pre-stage, PHASE 2 the full-data iterations)\n";
+		cout << "TIME PHASE 2 = "<<chrono::duration_cast<chrono::microseconds>(end-end_phase1).count()<<"μs\n" << endl;
+		auto loop_begin = (use_reduction || use_subsample) ? end_phase1 : begin; // don't spread the pre-stage over the refinement iterations
+		cout << "AV TIME PER ITERATION = " << (chrono::duration_cast<chrono::microseconds>(end-loop_begin).count() / max(1, iterations)) << "μs\n\n\n" << endl;
+	}
+};
+
+// Hashes/compares points by their values only (bit patterns, so -0.0 and 0.0 stay distinct rows)
+struct PointValuesHashCompare
+{
+	vector<Point>* points;
+	vector<size_t>* hashes;
+
+	size_t hash(int i) const
+	{
+		return (*hashes)[i];
+	}
+
+	bool equal(int a, int b) const
+	{
+		vector<double>& va = (*points)[a].getValues();
+		vector<double>& vb = (*points)[b].getValues();
+		return memcmp(va.data(), vb.data(), va.size() * sizeof(double)) == 0;
+	}
+};
+
+// Collapse exact duplicate rows into one weighted point each (kept in order of first appearance).
+// source_rows receives, for every input row, the index of the point it ended up in.
+// The cluster sums then add weight * x once instead of x weight times, in another order, so they can differ from
+// the run without --dedupe in the last bits (make check-dedupe bounds what that does to the result).
+void dedupePoints(vector<Point> & points, vector<int>& source_rows)
+{
+	int total_points = points.size();
+	vector<size_t> hashes(total_points);
+	tbb::parallel_for(0, total_points, 1, [&](int i) {
+		vector<double>& values = points[i].getValues();
+		size_t h = 1469598103934665603ULL; // FNV-1a over the raw bytes
+		const unsigned char* bytes = (const unsigned char*)values.data();
+		for(size_t b = 0; b < values.size() * sizeof(double); b++)
+			h = (h ^ bytes[b]) * 1099511628211ULL;
+		hashes[i] = h;
+	});
+
+	// Every row maps to the first row with the same values
+	PointValuesHashCompare compare = { &points, &hashes };
+	tbb::concurrent_hash_map<int, int, PointValuesHashCompare> first_row(compare);
+	tbb::parallel_for(0, total_points, 1, [&](int i) {
+		tbb::concurrent_hash_map<int, int, PointValuesHashCompare>::accessor acc;
+		if(first_row.insert(acc, i))
+			acc->second = i;
+		else if(i < acc->second)
+			acc->second = i;
+	});
+	vector<int> representative(total_points);
+	tbb::parallel_for(0, total_points, 1, [&](int i) {
+		tbb::concurrent_hash_map<int, int, PointValuesHashCompare>::const_accessor acc;
+		first_row.find(acc, i);
+		representative[i] = acc->second;
+	});
+
+	vector<int> weights(total_points, 0);
+	for(int i = 0; i < total_points; i++)
+		weights[representative[i]]++;
+
+	source_rows.resize(total_points);
+	int unique_points = 0;
+	for(int i = 0; i < total_points; i++)
+	{
+		if(representative[i] == i)
+		{
+			source_rows[i] = unique_points;
+			if(unique_points != i)
+				points[unique_points] = move(points[i]);
+			points[unique_points].setWeight(weights[i]);
+			unique_points++;
+		}
+		else
+			source_rows[i] = source_rows[representative[i]];
+	}
+	points.resize(unique_points, points[0]);
+}
+
+// Values of one input line into values[0, total_attr); false for blank/short lines.
+// 'rest' (if given) is left pointing after the last value, i.e. at the optional name.
+bool parsePointLine(const string& line, int total_attr, double* values, const char** rest = nullptr)
+{
+	const char* cursor = line.c_str();
+	for(int j = 0; j < total_attr; j++)
+	{
+		char* next;
+		values[j] = strtod(cursor, &next);
+		if(next == cursor)
+			return false;
+		cursor = next;
+	}
+	if(rest != nullptr)
+		*rest = cursor;
+	return true;
+}
+
+bool parsePointLine(const string& line, int total_attr, vector<double>& values)
+{
+	values.resize(total_attr);
+	return parsePointLine(line, total_attr, values.data());
+}
+
+// Points of total_attr zeros each, the loaders parse / read the values straight into them (no second copy of
+// the matrix)
+void allocatePoints(int total_points, int total_attr, vector<Point> & points)
+{
+	points.clear();
+	points.reserve(total_points);
+	vector<double> row(total_attr, 0.0);
+	for(int i = 0; i < total_points; i++)
+		points.push_back(Point(i, row));
+}
+
+// Lines the parallel loader holds at a time
+const int LOAD_CHUNK_LINES = 16384;
+
+// Parallel loader: read LOAD_CHUNK_LINES lines, parse them in parallel chunks into their points, repeat, so only
+// the points and one chunk of lines are in memory. With 'stats', each thread also folds its rows into its own
+// ColumnStats and those get merged, so the column statistics come for free with parsing.
+bool loadPoints(int total_points, int total_attr, bool has_name, vector<Point> & points, ColumnStats* stats)
+{
+	allocatePoints(total_points, total_attr, points);
+	tbb::enumerable_thread_specific<ColumnStats> local_stats([&]() { return ColumnStats(total_attr); });
+	vector<string> lines;
+	lines.reserve(min(total_points, LOAD_CHUNK_LINES));
+	string line;
+	for(int first = 0; first < total_points; first += lines.size())
+	{
+		lines.clear();
+		while((int)lines.size() < LOAD_CHUNK_LINES && first + (int)lines.size() < total_points && getline(cin, line))
+			if(line.find_first_not_of(" \t\r") != string::npos)
+				lines.push_back(move(line));
+		if(lines.empty())
+			return false;
+
+		atomic<bool> ok(true);
+		tbb::parallel_for(tbb::blocked_range<int>(0, lines.size()), [&](const tbb::blocked_range<int>& r) {
+			ColumnStats* thread_stats = stats != nullptr ? &local_stats.local() : nullptr;
+			for(int l = r.begin(); l < r.end(); l++)
+			{
+				double* row = points[first + l].getValues().data();
+				const char* rest;
+				if(!parsePointLine(lines[l], total_attr, row, &rest))
+				{
+					ok = false;
+					return;
+				}
+				if(has_name)
+				{
+					string name;
+					stringstream name_stream(rest);
+					name_stream >> name;
+					points[first + l].setName(name);
+				}
+				if(thread_stats != nullptr)
+					thread_stats->add(row);
+			}
+		});
+		if(!ok)
+			return false;
+	}
+
+	if(stats != nullptr)
+	{
+		*stats = ColumnStats(total_attr);
+		for(auto& thread_stats : local_stats)
+			stats->merge(thread_stats);
+	}
+	return true;
+}
+
+// Binary dataset (binary-points.h, header already read): every row read straight into its point, then the column
+// statistics (if asked for) in parallel over the points
+bool loadBinaryPoints(int total_points, int total_attr, vector<Point> & points, ColumnStats* stats)
+{
+	allocatePoints(total_points, total_attr, points);
+	for(int i = 0; i < total_points; i++)
+		if(!cin.read((char*)points[i].getValues().data(), total_attr * sizeof(double)))
+			return false;
+
+	if(stats != nullptr)
+	{
+		tbb::enumerable_thread_specific<ColumnStats> local_stats([&]() { return ColumnStats(total_attr); });
+		tbb::parallel_for(tbb::blocked_range<int>(0, total_points), [&](const tbb::blocked_range<int>& r) {
+			ColumnStats& thread_stats = local_stats.local();
+			for(int i = r.begin(); i < r.end(); i++)
+				thread_stats.add(points[i].getValues().data());
+		});
+		*stats = ColumnStats(total_attr);
+		for(auto& thread_stats : local_stats)
+			stats->merge(thread_stats);
+	}
+	return true;
+}
+
+// loadPoints for the index:value format: lines parsed in parallel into per-row entries, then packed into CSR
+bool loadSparsePoints(int total_points, int total_attr, SparseMatrix& matrix)
+{
+	vector<string> lines(total_points);
+	for(int i = 0; i < total_points; i++)
+		if(!getline(cin, lines[i]))
+			return false;
+
+	vector<vector<pair<int, double>>> rows(total_points);
+	atomic<bool> ok(true);
+	tbb::parallel_for(tbb::blocked_range<int>(0, total_points), [&](const tbb::blocked_range<int>& r) {
+		for(int i = r.begin(); i < r.end(); i++)
+			if(!parseSparseLine(lines[i], total_attr, rows[i]))
+				ok = false;
+	});
+	if(!ok)
+		return false;
+
+	matrix.total_points = total_points;
+	matrix.total_attr = total_attr;
+	matrix.row_start.resize(total_points + 1);
+	matrix.row_start[0] = 0;
+	for(int i = 0; i < total_points; i++)
+		matrix.row_start[i + 1] = matrix.row_start[i] + rows[i].size();
+	matrix.attr_index.resize(matrix.nonZeros());
+	matrix.values.resize(matrix.nonZeros());
+	tbb::parallel_for(0, total_points, 1, [&](int i) {
+		int64_t k = matrix.row_start[i];
+		for(auto& entry : rows[i])
+		{
+			matrix.attr_index[k] = entry.first;
+			matrix.values[k++] = entry.second;
+		}
+	});
+	return true;
+}
+
+// Single pass over stdin keeping only a merge-reduce coreset. A pipeline overlaps reading the next bucket of
+// lines, parsing buckets (in parallel) and inserting them into the coreset; at most STREAM_TOKENS buckets are
+// in flight. total_points == 0 reads until EOF.
+vector<Point> streamCoreset(int total_points, int total_attr, int bucket_size)
+{
+	const int STREAM_TOKENS = 4;
+	MergeReduceCoreset<Point> coreset(total_attr, bucket_size, rand()); // Random seed is defined in main
+	long long lines_read = 0;
+
+	auto begin = chrono::high_resolution_clock::now();
+	tbb::parallel_pipeline(STREAM_TOKENS,
+		tbb::make_filter<void, vector<string>*>(tbb::filter_mode::serial_in_order,
+			[&](tbb::flow_control& fc) -> vector<string>* {
+				vector<string>* lines = new vector<string>();
+				string line;
+				while((int)lines->size() < bucket_size && (total_points == 0 || lines_read < total_points) && getline(cin, line))
+				{
+					lines->push_back(line);
+					lines_read++;
+				}
+				if(lines->empty())
+				{
+					delete lines;
+					fc.stop();
+					return nullptr;
+				}
+				return lines;
+			}) &
+		tbb::make_filter<vector<string>*, vector<Point>*>(tbb::filter_mode::parallel,
+			[&](vector<string>* lines) {
+				vector<Point>* bucket = new vector<Point>();
+				vector<double> values;
+				for(auto& line : *lines)
+				{
+					if(parsePointLine(line, total_attr, values))
+						bucket->push_back(Point(bucket->size(), values));
+				}
+				delete lines;
+				return bucket;
+			}) &
+		tbb::make_filter<vector<Point>*, void>(tbb::filter_mode::serial_in_order,
+			[&](vector<Point>* bucket) {
+				if(!bucket->empty())
+					coreset.insert(*bucket);
+				delete bucket;
+			})
+	);
+	auto end = chrono::high_resolution_clock::now();
+
+	vector<Point> points = coreset.getCoreset();
+	cout << "Streaming: " << coreset.getPointsSeen() << " points read, coreset of " << points.size()
+		<< " weighted points (bucket " << bucket_size << ", " << coreset.getLevels() << " levels, peak "
+		<< coreset.getPeakPoints() << " points held) in "
+		<< chrono::duration_cast<chrono::microseconds>(end-begin).count() << "μs" << endl;
+	return points;
+}
+
+// Predict mode: assign every point to the nearest centroid of a saved model. With deduplicated points,
+// source_rows maps every input row to its point and the labels are written per input row.
+int predictWithModel(const string& model_file, vector<Point> & points, const vector<int>& source_rows,
+	NearestEngine nearest_engine, const string& labels_out, bool labels_binary)
+{
+	KMeansModel model;
+	if(!readModel(model_file, model))
+		return 1;
+	int total_points = points.size();
+	if(total_points == 0 || points[0].getTotalValues() != model.total_attr)
+	{
+		cout << "Model has " << model.total_attr << " attributes, dataset doesn't match" << endl;
+		return 1;
+	}
+
+	KMeans kmeans(model.K, total_points, model.total_attr, 1);
+	kmeans.setNearestEngine(nearest_engine);
+	kmeans.setModel(model);
+
+	vector<int> labels;
+	auto begin = chrono::high_resolution_clock::now();
+	if(model.scaling.enabled())
+		tbb::parallel_for(0, total_points, 1, [&](int i) {
+			model.scaling.apply(points[i].getValues().data());
+		});
+	kmeans.predict(points, labels);
+	if(!source_rows.empty())
+	{
+		vector<int> row_labels(source_rows.size());
+		tbb::parallel_for(0, (int)source_rows.size(), 1, [&](int r) {
+			row_labels[r] = labels[source_rows[r]];
+		});
+		labels.swap(row_labels);
+	}
+	auto end = chrono::high_resolution_clock::now();
+	double seconds = chrono::duration_cast<chrono::nanoseconds>(end-begin).count() / 1e9;
+
+	cout << "Model: K = " << model.K << ", " << model.total_attr << " attributes"
+		<< (model.scaling.enabled() ? string(", ") + model.scaling.name() + " scaled" : "") << "\n";
+	cout << "PREDICT TIME = " << chrono::duration_cast<chrono::microseconds>(end-begin).count() << "μs ("
+		<< (long long)(total_points / seconds) << " points/sec)\n";
+
+	if(!labels_out.empty() && !writeLabels(labels_out, labels, labels_binary))
+		return 1;
+	return 0;
+}
+
+// ======================= K SWEEP ======================= //
+struct SweepResult
+{
+	int K;
+	double inertia;
+	int iterations;
+	long long time_us;
+	double silhouette;
+};
+
+// Mean silhouette over 'samples' randomly chosen points. Each sampled point still gets its exact a(i) and b(i)
+// (mean distance to every point of its own / the closest other cluster), the samples run in parallel.
+double sampledSilhouette(vector<Point> & points, vector<int>& labels, int K, int samples, unsigned int seed)
+{
+	int total_points = points.size();
+	int total_attr = points[0].getTotalValues();
+	vector<double> cluster_weight(K, 0.0);
+	for(int i = 0; i < total_points; i++)
+		cluster_weight[labels[i]] += points[i].getWeight();
+
+	mt19937 gen(seed);
+	uniform_int_distribution<int> pick(0, total_points - 1);
+	vector<int> sample(min(samples, total_points));
+	for(auto& s : sample)
+		s = pick(gen);
+
+	double total = tbb::parallel_reduce(tbb::blocked_range<int>(0, (int)sample.size()), 0.0,
+		[&](const tbb::blocked_range<int>& r, double sum) {
+			vector<double> dist_sums(K);
+			for(int s = r.begin(); s < r.end(); s++)
+			{
+				int i = sample[s];
+				int own = labels[i];
+				double* p_vals = points[i].getValues().data();
+				fill(dist_sums.begin(), dist_sums.end(), 0.0);
+				for(int j = 0; j < total_points; j++)
+					dist_sums[labels[j]] += points[j].getWeight() * sqrt(squaredDistance(p_vals, points[j].getValues().data(), total_attr));
+
+				double own_others = cluster_weight[own] - 1; // the point itself contributed distance 0
+				if(own_others <= 0)
+					continue; // singleton cluster: s(i) = 0
+				double a = dist_sums[own] / own_others;
+				double b = INFINITY;
+				for(int c = 0; c < K; c++)
+					if(c != own && cluster_weight[c] > 0)
+						b = min(b, dist_sums[c] / cluster_weight[c]);
+				if(b < INFINITY && max(a, b) > 0)
+					sum += (b - a) / max(a, b);
+			}
+			return sum;
+		}, plus<double>());
+	return total / sample.size();
+}
+
+// Point farthest from its nearest centroid: seed for the extra cluster when warm starting K + 1 from K
+int farthestPoint(vector<Point> & points, KMeans<>& kmeans, int total_attr)
+{
+	vector<double>& centroids = kmeans.getCentralValues();
+	vector<int> labels;
+	kmeans.predict(points, labels);
+	pair<double, int> best = tbb::parallel_reduce(tbb::blocked_range<int>(0, (int)points.size()), make_pair(-1.0, 0),
+		[&](const tbb::blocked_range<int>& r, pair<double, int> best) {
+			for(int i = r.begin(); i < r.end(); i++)
+			{
+				double dist = squaredDistance(&centroids[(size_t)labels[i] * total_attr], points[i].getValues().data(), total_attr);
+				if(dist > best.first)
+					best = make_pair(dist, i);
+			}
+			return best;
+		}, [](pair<double, int> a, pair<double, int> b) { return a.first >= b.first ? a : b; });
+	return best.second;
+}
+
+// Run every K in [k_min, k_max] over the same loaded points and print inertia (and silhouette) per K.
+// Independent runs go onto the TBB pool concurrently, each with its own seed, over the same points: every run
+// keeps its clusters in a label array of its own (setLabelArray), the points are only read. warm_start instead
+// runs K in order, seeding K + 1 with the K centroids plus the point farthest from them.
+int runKSweep(vector<Point> & points, int k_min, int k_max, int max_iterations, bool warm_start,
+	int silhouette_samples, NearestEngine nearest_engine)
+{
+	int total_points = points.size();
+	int total_attr = points[0].getTotalValues();
+	k_max = min(k_max, total_points);
+	if(k_min < 1 || k_min > k_max)
+	{
+		cout << "Invalid K range" << endl;
+		return 1;
+	}
+	vector<SweepResult> results(k_max - k_min + 1);
+
+	auto runOne = [&](int k, const vector<double>* seeds) {
+		auto begin = chrono::high_resolution_clock::now();
+		vector<int> run_labels;
+		KMeans kmeans(k, total_points, total_attr, max_iterations);
+		kmeans.setLabelArray(&run_labels);
+		kmeans.setVerbose(false);
+		kmeans.setSeed(123 + k); // For reproducibility, whatever order the runs get scheduled in
+		kmeans.setNearestEngine(nearest_engine);
+		if(seeds != nullptr)
+			kmeans.setInitialCentroids(*seeds);
+		kmeans.run(points);
+		auto end = chrono::high_resolution_clock::now();
+
+		SweepResult& result = results[k - k_min];
+		result.K = k;
+		result.iterations = kmeans.getIterations();
+		result.time_us = chrono::duration_cast<chrono::microseconds>(end-begin).count();
+		result.inertia = kmeans.computeInertia(points);
+		result.silhouette = 0.0;
+		if(silhouette_samples > 0 && k > 1)
+		{
+			vector<int> labels;
+			kmeans.predict(points, labels);
+			result.silhouette = sampledSilhouette(points, labels, k, silhouette_samples, 123 + k);
+		}
+		vector<double> next_seeds;
+		if(warm_start && k < k_max)
+		{
+			next_seeds = kmeans.getCentralValues();
+			vector<double>& far = points[farthestPoint(points, kmeans, total_attr)].getValues();
+			next_seeds.insert(next_seeds.end(), far.begin(), far.end());
+		}
+		return next_seeds;
+	};
+
+	auto begin = chrono::high_resolution_clock::now();
+	if(warm_start)
+	{
+		vector<double> seeds;
+		for(int k = k_min; k <= k_max; k++)
+			seeds = runOne(k, k == k_min ? nullptr : &seeds);
+	}
+	else
+		tbb::parallel_for(k_min, k_max + 1, 1, [&](int k) { runOne(k, nullptr); });
+	auto end = chrono::high_resolution_clock::now();
+
+	cout << "K sweep " << k_min << ".." << k_max << (warm_start ? " (warm start from K - 1)" : " (concurrent)") << "\n";
+	cout << "K\tINERTIA\tITERATIONS\tTIME(μs)" << (silhouette_samples > 0 ? "\tSILHOUETTE" : "") << "\n";
+	for(auto& result : results)
+	{
+		cout << result.K << "\t" << result.inertia << "\t" << result.iterations << "\t" << result.time_us;
+		if(silhouette_samples > 0)
+			cout << "\t" << result.silhouette;
+		cout << "\n";
+	}
+	cout << "TOTAL SWEEP TIME = " << chrono::duration_cast<chrono::microseconds>(end-begin).count() << "μs" << endl;
+	return 0;
+}
+
+// ======================= BISECTING K-MEANS ======================= //
+struct BisectLeaf
+{
+	vector<int> members; // indexes into the points
+	vector<double> centroid;
+	double sse;          // weighted sum of squared distances to the centroid
+	bool splittable;
+};
+
+// Split one leaf with 2-means (the regular KMeans on a copy of its points). False if it won't split, e.g. every
+// attempt put all points on one side because they are (nearly) identical.
+bool splitLeaf(vector<Point> & points, const BisectLeaf& leaf, int total_attr, int split_iterations,
+	unsigned int seed, BisectLeaf& left, BisectLeaf& right)
+{
+	int n = leaf.members.size();
+	vector<Point> local_points;
+	local_points.reserve(n);
+	for(int idx : leaf.members)
+		local_points.push_back(points[idx]);
+
+	for(int attempt = 0; attempt < 3; attempt++)
+	{
+		KMeans kmeans(2, n, total_attr, split_iterations);
+		kmeans.setVerbose(false);
+		kmeans.setSeed(seed + attempt);
+		kmeans.setNearestEngine(NEAREST_LINEAR);
+		kmeans.run(local_points);
+		vector<int> labels;
+		kmeans.predict(local_points, labels);
+
+		BisectLeaf* children[2] = { &left, &right };
+		double weights[2] = { 0.0, 0.0 };
+		for(int c = 0; c < 2; c++)
+		{
+			children[c]->members.clear();
+			children[c]->centroid.assign(total_attr, 0.0);
+			children[c]->sse = 0.0;
+			children[c]->splittable = true;
+		}
+		for(int i = 0; i < n; i++)
+		{
+			double w = local_points[i].getWeight();
+			double* p_vals = local_points[i].getValues().data();
+			BisectLeaf& child = *children[labels[i]];
+			child.members.push_back(leaf.members[i]);
+			for(int j = 0; j < total_attr; j++)
+				child.centroid[j] += w * p_vals[j];
+			weights[labels[i]] += w;
+		}
+		if(left.members.empty() || right.members.empty())
+			continue;
+
+		for(int c = 0; c < 2; c++)
+			for(int j = 0; j < total_attr; j++)
+				children[c]->centroid[j] /= weights[c];
+		for(int i = 0; i < n; i++)
+			children[labels[i]]->sse += local_points[i].getWeight()
+				* squaredDistance(children[labels[i]]->centroid.data(), local_points[i].getValues().data(), total_attr);
+		return true;
+	}
+	return false;
+}
+
+// Bisecting k-means: start from one leaf holding every point and repeatedly split leaves in two until there are
+// K of them. Each round splits the (up to K - leaves) leaves with the largest SSE, as independent parallel tasks,
+// so the number of leaves roughly doubles per round: about log2(K) rounds, each touching every point a few times
+// with K = 2, instead of every iteration comparing every point against all K centroids.
+// Returns the leaf centroids (leaves * total_attr); fewer than K leaves if the data runs out of distinct points.
+vector<double> bisectingCentroids(vector<Point> & points, int K, int split_iterations, unsigned int seed, int& rounds)
+{
+	int total_points = points.size();
+	int total_attr = points[0].getTotalValues();
+
+	vector<BisectLeaf> leaves(1);
+	leaves[0].members.resize(total_points);
+	iota(leaves[0].members.begin(), leaves[0].members.end(), 0);
+	leaves[0].centroid.assign(total_attr, 0.0);
+	double total_weight = 0.0;
+	for(auto& p : points)
+	{
+		for(int j = 0; j < total_attr; j++)
+			leaves[0].centroid[j] += p.getWeight() * p.getValue(j);
+		total_weight += p.getWeight();
+	}
+	for(auto& v : leaves[0].centroid)
+		v /= total_weight;
+	leaves[0].sse = INFINITY; // only used to order the candidates
+	leaves[0].splittable = true;
+
+	rounds = 0;
+	while((int)leaves.size() < K)
+	{
+		vector<int> candidates;
+		for(int l = 0; l < (int)leaves.size(); l++)
+			if(leaves[l].splittable && leaves[l].members.size() >= 2 && leaves[l].sse > 0.0)
+				candidates.push_back(l);
+		if(candidates.empty())
+			break;
+		sort(candidates.begin(), candidates.end(), [&](int a, int b) {
+			return leaves[a].sse > leaves[b].sse || (leaves[a].sse == leaves[b].sse && a < b);
+		});
+		candidates.resize(min((int)candidates.size(), K - (int)leaves.size()));
+
+		int total_candidates = candidates.size();
+		vector<BisectLeaf> lefts(total_candidates), rights(total_candidates);
+		vector<char> split(total_candidates, 0);
+		tbb::parallel_for(0, total_candidates, 1, [&](int c) {
+			// Seed by leaf position, not by task: the tree doesn't depend on the schedule
+			split[c] = splitLeaf(points, leaves[candidates[c]], total_attr, split_iterations,
+				seed + 7919 * rounds + 3 * candidates[c], lefts[c], rights[c]);
+		});
+
+		for(int c = 0; c < total_candidates; c++)
+		{
+			if(!split[c])
+			{
+				leaves[candidates[c]].splittable = false;
+				continue;
+			}
+			leaves[candidates[c]] = move(lefts[c]);
+			leaves.push_back(move(rights[c]));
+		}
+		rounds++;
+	}
+
+	vector<double> centroids;
+	centroids.reserve(leaves.size() * total_attr);
+	for(auto& leaf : leaves)
+		centroids.insert(centroids.end(), leaf.centroid.begin(), leaf.centroid.end());
+	return centroids;
+}
+
+// Plain Lloyd run with a non default distance policy
+template <class Metric>
+void runWithMetric(vector<Point> & points, int K, int total_attr, int max_iterations, double subsample_fraction,
+	const vector<int>& source_rows, NearestEngine nearest_engine, const FeatureScaling& scaling, IterationTrace* trace,
+	PhaseCounters* counters)
+{
+	KMeans<Metric> kmeans(K, points.size(), total_attr, max_iterations);
+	kmeans.setNearestEngine(nearest_engine);
+	kmeans.setSubsample(subsample_fraction);
+	if(!source_rows.empty())
+		kmeans.setSourceRows(source_rows);
+	kmeans.setScaling(scaling);
+	kmeans.setTrace(trace);
+	kmeans.setCounters(counters);
+	kmeans.run(points);
+}
+
+// Server mode: load the model once, then answer assign requests on a Unix domain socket until killed
+int serveModel(const string& model_file, const string& socket_path, NearestEngine nearest_engine)
+{
+	KMeansModel model;
+	if(!readModel(model_file, model))
+		return 1;
+
+	KMeans kmeans(model.K, 0, model.total_attr, 1);
+	kmeans.setNearestEngine(nearest_engine);
+	kmeans.setModel(model);
+	kmeans.prepareModel();
+
+	vector<double> scaled_rows; // only the batcher thread calls assign
+	AssignServer server(model.K, model.total_attr, [&](const double* rows, int count, int* labels) {
+		if(model.scaling.enabled())
+		{
+			scaled_rows.assign(rows, rows + (size_t)count * model.total_attr);
+			for(int i = 0; i < count; i++)
+				model.scaling.apply(&scaled_rows[(size_t)i * model.total_attr]);
+			rows = scaled_rows.data();
+		}
+		kmeans.assignRows(rows, count, labels);
+	});
+	cout << "Serving model " << model_file << " (K = " << model.K << ", " << model.total_attr
+		<< " attributes) on " << socket_path << endl;
+	return server.serve(socket_path);
+}
+
+// bin/kmeans --engine=parallel-fast (and bin/kmeans-parallel-fast) end up here with all their options
+int parallelFastMain(int argc, char *argv[])
+{
+	NearestEngine nearest_engine = NEAREST_AUTO;
+	int pq_rerank = 8, pq_subspaces = 0;
+	ReductionMethod reduction_method = REDUCE_RANDOM_PROJECTION;
+	int reduced_attr = 0, refine_iterations = 10;
+	double subsample_fraction = 0.0;
+	bool dedupe = false;
+	int stream_bucket = 0; // 0 = load everything
+	int online_batches = 0, online_refine = 5;
+	string model_out, predict_model, labels_out;
+	ModelDType model_dtype = MODEL_FLOAT64;
+	bool labels_binary = false;
+	string serve_socket, serve_model;
+	int sweep_k_min = 0, sweep_k_max = 0, silhouette_samples = 0;
+	bool sweep_warm = false;
+	bool bisect = false;
+	int bisect_refine = 0;
+	ScalingMethod scaling_method = SCALE_NONE;
+	int quantize_bits = 0;
+	bool sparse = false;
+	string metric = "l2";
+	int threads = 0; // 0 = TBB default (all cores)
+	int k_override = 0, max_iterations_override = 0; // 0 = as the dataset header says
+	unsigned int seed = 123;
+	string trace_jsonl, trace_chrome;
+	bool perf_counters = false;
+	bool dry_run = false;
+	for(int a = 1; a < argc; a++)
+	{
+		string arg = argv[a];
+		if(arg == "--nearest=linear")
+			nearest_engine = NEAREST_LINEAR;
+		else if(arg == "--nearest=balltree")
+			nearest_engine = NEAREST_BALLTREE;
+		else if(arg == "--nearest=auto")
+			nearest_engine = NEAREST_AUTO;
+		else if(arg == "--nearest=pq")
+			nearest_engine = NEAREST_PQ;
+		else if(arg.rfind("--pq-rerank=", 0) == 0)
+			pq_rerank = stoi(arg.substr(12));
+		else if(arg.rfind("--pq-subspaces=", 0) == 0)
+			pq_subspaces = stoi(arg.substr(15));
+		else if(arg.rfind("--reduce=rp:", 0) == 0 || arg.rfind("--reduce=pca:", 0) == 0)
+		{
+			reduction_method = arg[9] == 'p' ? REDUCE_PCA : REDUCE_RANDOM_PROJECTION;
+			reduced_attr = stoi(arg.substr(arg.find(':') + 1));
+		}
+		else if(arg.rfind("--subsample=", 0) == 0)
+			subsample_fraction = stod(arg.substr(12));
+		else if(arg.rfind("--refine-iterations=", 0) == 0)
+			refine_iterations = stoi(arg.substr(20));
+		else if(arg == "--dedupe")
+			dedupe = true;
+		else if(arg == "--stream")
+			stream_bucket = -1; // pick from K below
+		else if(arg.rfind("--stream=", 0) == 0)
+			stream_bucket = stoi(arg.substr(9));
+		else if(arg.rfind("--online=", 0) == 0)
+			online_batches = stoi(arg.substr(9));
+		else if(arg.rfind("--online-refine=", 0) == 0)
+			online_refine = stoi(arg.substr(16));
+		else if(arg.rfind("--model-out=", 0) == 0)
+			model_out = arg.substr(12);
+		else if(arg == "--model-dtype=f32")
+			model_dtype = MODEL_FLOAT32;
+		else if(arg == "--model-dtype=f64")
+			model_dtype = MODEL_FLOAT64;
+		else if(arg.rfind("--predict=", 0) == 0)
+			predict_model = arg.substr(10);
+		else if(arg.rfind("--labels-out=", 0) == 0)
+			labels_out = arg.substr(13);
+		else if(arg == "--labels-format=bin")
+			labels_binary = true;
+		else if(arg == "--labels-format=text")
+			labels_binary = false;
+		else if(arg.rfind("--serve=", 0) == 0)
+			serve_socket = arg.substr(8);
+		else if(arg.rfind("--model=", 0) == 0)
+			serve_model = arg.substr(8);
+		else if(arg.rfind("--sweep-k=", 0) == 0 && arg.find(':') != string::npos)
+		{
+			sweep_k_min = stoi(arg.substr(10));
+			sweep_k_max = stoi(arg.substr(arg.find(':') + 1));
+		}
+		else if(arg == "--sweep-warm")
+			sweep_warm = true;
+		else if(arg.rfind("--silhouette=", 0) == 0)
+			silhouette_samples = stoi(arg.substr(13));
+		else if(arg == "--scale=zscore")
+			scaling_method = SCALE_ZSCORE;
+		else if(arg == "--scale=minmax")
+			scaling_method = SCALE_MINMAX;
+		else if(arg == "--quantize=int8")
+			quantize_bits = QUANTIZED_INT8;
+		else if(arg == "--quantize=int16")
+			quantize_bits = QUANTIZED_INT16;
+		else if(arg == "--metric=l2" || arg == "--metric=cosine" || arg == "--metric=l1")
+			metric = arg.substr(9);
+		else if(arg.rfind("--threads=", 0) == 0)
+			threads = stoi(arg.substr(10));
+		else if(arg.rfind("--k=", 0) == 0)
+			k_override = stoi(arg.substr(4));
+		else if(arg.rfind("--max-iter=", 0) == 0 || arg.rfind("--max-iterations=", 0) == 0) // the long form is an alias
+			max_iterations_override = stoi(arg.substr(arg.find('=') + 1));
+		else if(arg.rfind("--seed=", 0) == 0)
+			seed = stoul(arg.substr(7));
+		else if(arg == "--sparse")
+			sparse = true;
+		else if(arg.rfind("--trace-jsonl=", 0) == 0)
+			trace_jsonl = arg.substr(14);
+		else if(arg.rfind("--trace-chrome=", 0) == 0)
+			trace_chrome = arg.substr(15);
+		else if(arg == "--perf-counters")
+			perf_counters = true;
+		else if(arg == "--dry-run")
+			dry_run = true;
+		else if(arg == "--bisect")
+			bisect = true;
+		else if(arg.rfind("--bisect-refine=", 0) == 0)
+		{
+			bisect = true;
+			bisect_refine = stoi(arg.substr(16));
+		}
+		else
+		{
+			cout << "Unknown option: " << arg << endl;
+			cout << "Usage: cat dataset | " << argv[0] << " [--nearest=auto|linear|balltree|pq] [--pq-rerank=R] [--pq-subspaces=M]"
+				<< " [--reduce=rp:D|pca:D] [--refine-iterations=N] [--subsample=FRACTION] [--dedupe]"
+				<< " [--stream[=BUCKET]] [--online=BATCHES] [--online-refine=N]"
+				<< " [--model-out=FILE] [--model-dtype=f64|f32]"
+				<< " [--predict=MODEL] [--labels-out=FILE] [--labels-format=text|bin]"
+				<< " [--sweep-k=MIN:MAX [--sweep-warm] [--silhouette=SAMPLES]] [--bisect [--bisect-refine=ITERATIONS]]"
+				<< " [--scale=zscore|minmax] [--quantize=int8|int16] [--sparse (index:value input)] [--metric=l2|cosine|l1] [--threads=N]"
+				<< " [--k=K] [--max-iter=N] [--seed=S]"
+				<< " [--trace-jsonl=FILE] [--trace-chrome=FILE] [--perf-counters] [--dry-run (memory estimate only)]"
+				<< "\n   or: " << argv[0] << " --serve=SOCKET --model=MODEL [--nearest=...]" << endl;
+			return 1;
+		}
+	}
+
+	unique_ptr<tbb::global_control> thread_limit;
+	if(threads > 0)
+		thread_limit.reset(new tbb::global_control(tbb::global_control::max_allowed_parallelism, threads));
+
+	if(!serve_socket.empty())
+	{
+		if(serve_model.empty())
+		{
+			cout << "--serve needs --model=MODEL" << endl;
+			return 1;
+		}
+		return serveModel(serve_model, serve_socket, nearest_engine);
+	}
+
+	string first_line;
+	bool binary_input = isBinaryPoints(cin);
+	if(binary_input)
+	{
+		// Same "N D K iterations has_name" info as a text header
+		BinaryPointsHeader binary_header;
+		if(!readBinaryPointsHeader(cin, binary_header) || binary_header.total_points > INT32_MAX)
+		{
+			cout << "Invalid binary dataset header" << endl;
+			return 1;
+		}
+		first_line = to_string(binary_header.total_points) + " " + to_string(binary_header.total_attr) + " "
+			+ to_string(binary_header.K) + " " + to_string(binary_header.max_iterations) + " 0";
+	}
+	else
+		getline(cin, first_line);
+
+	// IMPORTANT: Remove byte-order-mark (BOM) if it exists
+	if (first_line.size() > 0 && first_line[0] == '\xEF' && first_line[1] == '\xBB' && first_line[2] == '\xBF') {
+		first_line.erase(0, 3);
+	}
+
+	cout << "Dataset info: " << first_line << endl;
+
+	// Use stringstream to split the first line into integers
+	stringstream ss(first_line);
+	int total_points, total_attr, K, max_iterations, has_name;
+	ss >> total_points >> total_attr >> K >> max_iterations >> has_name;
+	if(k_override > 0)
+		K = k_override;
+	if(max_iterations_override > 0)
+		max_iterations = max_iterations_override;
+
+	// In streaming mode total_points == 0 means "until EOF"
+	if ((total_points == 0 && stream_bucket == 0) || total_attr == 0 || K == 0 || max_iterations == 0)
+	{
+		cout << "Invalid input" << endl;
+		return 1;
+	}
+
+	if(binary_input && (sparse || stream_bucket != 0))
+	{
+		cout << "--sparse and --stream read text input only" << endl;
+		return 1;
+	}
+	if(scaling_method != SCALE_NONE && stream_bucket != 0)
+	{
+		cout << "--scale needs the column statistics before clustering, it can't be combined with --stream" << endl;
+		return 1;
+	}
+	if(scaling_method != SCALE_NONE && !predict_model.empty())
+		scaling_method = SCALE_NONE; // the model brings its own scaling
+	if(!labels_out.empty() && predict_model.empty() && (sparse || stream_bucket != 0 || online_batches > 1 || sweep_k_max > 0))
+	{
+		cout << "--labels-out needs a label for every input row, --sparse, --stream, --online and --sweep-k don't keep them" << endl;
+		return 1;
+	}
+
+	if(metric != "l2" && (sparse || stream_bucket != 0 || quantize_bits != 0 || !model_out.empty() || !predict_model.empty()
+		|| online_batches > 1 || bisect || sweep_k_max > 0 || reduced_attr > 0))
+	{
+		cout << "--metric=" << metric << " only works with a plain run (the other modes assume squared L2)" << endl;
+		return 1;
+	}
+	if(metric != "l2" && (nearest_engine == NEAREST_BALLTREE || nearest_engine == NEAREST_PQ))
+	{
+		cout << "--nearest=balltree and --nearest=pq index squared L2 distances, --metric=" << metric << " scans linearly" << endl;
+		return 1;
+	}
+	if(subsample_fraction > 0.0 && reduced_attr > 0)
+	{
+		cout << "--subsample and --reduce are both pre-stages of the same run, pick one" << endl;
+		return 1;
+	}
+	// Only the plain run (after --stream too) sets these up, the other modes would silently drop them
+	if((quantize_bits != 0 || subsample_fraction > 0.0 || reduced_attr > 0)
+		&& (sparse || !predict_model.empty() || online_batches > 1 || bisect || sweep_k_max > 0))
+	{
+		cout << "--quantize, --subsample and --reduce only apply to a plain run, not to --sparse, --predict, --online,"
+			<< " --bisect or --sweep-k" << endl;
+		return 1;
+	}
+
+	if(dry_run)
+	{
+		// Header only: nothing is loaded
+		int estimate_threads = tbb::global_control::active_value(tbb::global_control::max_allowed_parallelism);
+		KMeans kmeans(K, total_points, total_attr, max_iterations);
+		kmeans.setNearestEngine(nearest_engine);
+		kmeans.printMemoryEstimate(estimate_threads, quantize_bits, dedupe);
+		return 0;
+	}
+
+	srand (seed); // For reproducibility
+
+	if(sparse)
+	{
+		auto begin_load = chrono::high_resolution_clock::now();
+		SparseMatrix matrix;
+		if(!loadSparsePoints(total_points, total_attr, matrix))
+		{
+			cout << "Invalid input" << endl;
+			return 1;
+		}
+		auto end_load = chrono::high_resolution_clock::now();
+		cout << "Sparse input: " << matrix.nonZeros() << " nonzeros (density "
+			<< 100.0 * matrix.nonZeros() / ((double)total_points * total_attr) << "%), loaded in "
+			<< chrono::duration_cast<chrono::microseconds>(end_load-begin_load).count() << "μs" << endl;
+
+		KMeans kmeans(K, total_points, total_attr, max_iterations);
+		kmeans.setModelOutput(model_out, model_dtype);
+		vector<int> labels;
+		kmeans.runSparse(matrix, labels);
+		return 0;
+	}
+
+	auto begin_load = chrono::high_resolution_clock::now();
+	vector<Point> points;
+	FeatureScaling scaling;
+	if(scaling_method != SCALE_NONE)
+	{
+		// Parallel parse w/ the column statistics gathered on the way, then scale in place
+		ColumnStats stats;
+		if(binary_input ? !loadBinaryPoints(total_points, total_attr, points, &stats)
+			: !loadPoints(total_points, total_attr, has_name, points, &stats))
+		{
+			cout << "Invalid input" << endl;
+			return 1;
+		}
+		scaling.fit(stats, scaling_method);
+		tbb::parallel_for(0, total_points, 1, [&](int i) {
+			scaling.apply(points[i].getValues().data());
+		});
+		auto end_scaling = chrono::high_resolution_clock::now();
+		cout << "Scaling: " << scaling.name() << " (load + column statistics + scaling in "
+			<< chrono::duration_cast<chrono::microseconds>(end_scaling-begin_load).count() << "μs), centroids are printed unscaled" << endl;
+	}
+	else if(binary_input && !loadBinaryPoints(total_points, total_attr, points, nullptr))
+	{
+		cout << "Invalid input" << endl;
+		return 1;
+	}
+	if(stream_bucket != 0)
+	{
+		if(stream_bucket < 0)
+			stream_bucket = max(20 * K, 512);
+		points = streamCoreset(total_points, total_attr, stream_bucket);
+		total_points = points.size();
+	}
+	else if(!scaling.enabled() && !binary_input && !loadPoints(total_points, total_attr, has_name, points, nullptr))
+	{
+		// Same check as the other engines (readDatasetValues): fewer rows or values than the header says
+		cout << "Truncated dataset" << endl;
+		return 1;
+	}
+	auto end_load = chrono::high_resolution_clock::now();
+	cout << "LOAD TIME = " << chrono::duration_cast<chrono::microseconds>(end_load-begin_load).count() << "μs" << endl;
+
+	vector<int> source_rows;
+	if(dedupe)
+	{
+		auto begin_dedupe = chrono::high_resolution_clock::now();
+		dedupePoints(points, source_rows);
+		auto end_dedupe = chrono::high_resolution_clock::now();
+		cout << "Dedupe: " << total_points << " rows -> " << points.size() << " weighted points (compression ratio "
+			<< (double)total_points / points.size() << "x) in "
+			<< chrono::duration_cast<chrono::microseconds>(end_dedupe-begin_dedupe).count() << "μs" << endl;
+		total_points = points.size();
+	}
+
+	if(stream_bucket == 0)
+		srand (seed); // For reproducibility (streaming already drew from it for the coreset)
+
+	KMeans kmeans(K, total_points, total_attr, max_iterations);
+	kmeans.setNearestEngine(nearest_engine);
+	kmeans.setPQRerankDepth(pq_rerank);
+	kmeans.setPQSubspaces(pq_subspaces);
+	kmeans.setReduction(reduction_method, reduced_attr, refine_iterations);
+	kmeans.setSubsample(subsample_fraction);
+	kmeans.setScaling(scaling);
+	if(dedupe)
+		kmeans.setSourceRows(source_rows);
+
+	// Only allocated when asked for: a null trace keeps run() uninstrumented
+	unique_ptr<IterationTrace> trace;
+	if(!trace_jsonl.empty() || !trace_chrome.empty())
+		trace.reset(new IterationTrace());
+	kmeans.setTrace(trace.get());
+	unique_ptr<PhaseCounters> counters;
+	if(perf_counters)
+		counters.reset(new PhaseCounters());
+	kmeans.setCounters(counters.get());
+
+	QuantizedPoints quantized_points;
+	if(quantize_bits != 0)
+	{
+		auto begin_quantize = chrono::high_resolution_clock::now();
+		quantized_points.build(total_points, total_attr, (QuantizedBits)quantize_bits,
+			[&](int i) { return (const double*)points[i].getValues().data(); },
+			[&](int i) { return points[i].getWeight(); });
+		kmeans.setQuantizedPoints(&quantized_points);
+		auto end_quantize = chrono::high_resolution_clock::now();
+		cout << "Quantization: " << chrono::duration_cast<chrono::microseconds>(end_quantize-begin_quantize).count() << "μs" << endl;
+	}
+
+	if(sweep_k_max > 0)
+		return runKSweep(points, sweep_k_min, sweep_k_max, max_iterations, sweep_warm, silhouette_samples, nearest_engine);
+
+	if(!predict_model.empty())
+		return predictWithModel(predict_model, points, source_rows, nearest_engine, labels_out, labels_binary);
+
+	kmeans.setModelOutput(model_out, model_dtype);
+	if(online_batches > 1)
+	{
+		// Train on the first batch, then fold the others in one at a time w/ the online API
+		int batch_size = total_points / online_batches;
+		vector<Point> first_batch(points.begin(), points.begin() + batch_size);
+		KMeans online_kmeans(K, batch_size, total_attr, max_iterations);
+		online_kmeans.setNearestEngine(nearest_engine);
+		online_kmeans.setPQRerankDepth(pq_rerank);
+		online_kmeans.setPQSubspaces(pq_subspaces);
+		online_kmeans.setScaling(scaling);
+		online_kmeans.setTrace(trace.get());
+		online_kmeans.setCounters(counters.get());
+		online_kmeans.run(first_batch);
+
+		for(int b = 1; b < online_batches; b++)
+		{
+			int batch_end = b == online_batches - 1 ? total_points : (b + 1) * batch_size;
+			vector<Point> batch(points.begin() + b * batch_size, points.begin() + batch_end);
+			auto begin_ingest = chrono::high_resolution_clock::now();
+			int refine = online_kmeans.ingest(batch, online_refine);
+			auto end_ingest = chrono::high_resolution_clock::now();
+			cout << "Ingested batch " << b + 1 << ": " << batch.size() << " points, " << online_kmeans.getTouchedClusters()
+				<< " clusters touched, " << refine << " refinement passes, "
+				<< chrono::duration_cast<chrono::microseconds>(end_ingest-begin_ingest).count() << "μs\n";
+		}
+		// The model is the state after the last batch, not the first batch run()
+		if(!model_out.empty() && writeModel(model_out, online_kmeans.getModel(), model_dtype))
+			cout << "Model written to " << model_out << "\n";
+		cout << "\nAfter online updates:\n\n";
+		online_kmeans.printCentroids();
+	}
+	else if(bisect)
+	{
+		// The leaves of the bisecting tree seed a flat Lloyd run of at most bisect_refine iterations
+		// (0 = keep the leaves as they are)
+		auto begin_bisect = chrono::high_resolution_clock::now();
+		int rounds;
+		vector<double> leaves = bisectingCentroids(points, K, max_iterations, seed, rounds);
+		auto end_bisect = chrono::high_resolution_clock::now();
+		int total_leaves = leaves.size() / total_attr;
+		cout << "Bisecting k-means: " << total_leaves << " leaves in " << rounds << " rounds, "
+			<< chrono::duration_cast<chrono::microseconds>(end_bisect-begin_bisect).count() << "μs\n";
+		if(total_leaves < K)
+			cout << "Only " << total_leaves << " distinct clusters could be split off, using K = " << total_leaves << "\n";
+
+		KMeans refined(total_leaves, total_points, total_attr, bisect_refine);
+		refined.setNearestEngine(nearest_engine);
+		refined.setPQRerankDepth(pq_rerank);
+		refined.setPQSubspaces(pq_subspaces);
+		refined.setModelOutput(model_out, model_dtype);
+		refined.setScaling(scaling);
+		refined.setInitialCentroids(leaves, chrono::duration_cast<chrono::microseconds>(end_bisect-begin_bisect).count());
+		refined.setTrace(trace.get());
+		refined.setCounters(counters.get());
+		refined.run(points);
+	}
+	else if(metric == "cosine")
+		runWithMetric<Cosine>(points, K, total_attr, max_iterations, subsample_fraction, source_rows, nearest_engine, scaling,
+			trace.get(), counters.get());
+	else if(metric == "l1")
+		runWithMetric<L1>(points, K, total_attr, max_iterations, subsample_fraction, source_rows, nearest_engine, scaling,
+			trace.get(), counters.get());
+	else
+		kmeans.run(points);
+
+	// Labels of the input rows (a collapsed duplicate gets the label of its point)
+	if(!labels_out.empty())
+	{
+		vector<int> labels(dedupe ? source_rows.size() : points.size());
+		tbb::parallel_for(0, (int)labels.size(), 1, [&](int r) {
+			labels[r] = points[dedupe ? source_rows[r] : r].getCluster();
+		});
+		if(!writeLabels(labels_out, labels, labels_binary))
+			return 1;
+	}
+
+	if(counters)
+	{
+		cout << "\nHardware counters:\n";
+		counters->report(cout, measureRoofline());
+	}
+
+	if(!trace_jsonl.empty())
+	{
+		if(!trace->writeJsonLines(trace_jsonl))
+		{
+			cerr << "Cannot write " << trace_jsonl << endl;
+			return 1;
+		}
+		cout << "Iteration trace written to " << trace_jsonl << "\n";
+	}
+	if(!trace_chrome.empty())
+	{
+		if(!trace->writeChromeTrace(trace_chrome))
+		{
+			cerr << "Cannot write " << trace_chrome << endl;
+			return 1;
+		}
+		cout << "Chrome trace written to " << trace_chrome << "\n";
+	}
+	return 0;
+}
+
+
+
+// libkmeans engine: plain runs through the common interface, bin/kmeans hands it the whole command line
+class ParallelFastEngine : public PointEngine<KMeans<>, Point>
+{
+protected:
+	void configure(KMeans<>& kmeans, const KMeansOptions& options) override
+	{
+		kmeans.setVerbose(false); // the caller prints the result
+		kmeans.setProgress(options.progress);
+	}
+
+	void collect(KMeans<>& kmeans, KMeansResult& result) override
+	{
+		result.cancelled = kmeans.isCancelled();
+	}
+
+public:
+	ParallelFastEngine() : PointEngine<KMeans<>, Point>("parallel-fast", true) {}
+
+	bool reportsProgress() const override
+	{
+		return true;
+	}
+
+	bool hasCommandLine() const override
+	{
+		return true;
+	}
+
+	int runCommandLine(int argc, char* argv[]) override
+	{
+		return parallelFastMain(argc, argv);
+	}
+};
+
+unique_ptr<KMeansEngine> makeParallelFastEngine()
+{
+	return unique_ptr<KMeansEngine>(new ParallelFastEngine());
+}
@@ -19,70 +19,13 @@
 #include <tbb/enumerable_thread_specific.h>
 #include <mutex>
 #include <tbb/global_control.h> // to control the number of threads
+#include "libkmeans.h"
+#include "point.h"
 
 using namespace std;
 
-class Point
+namespace
 {
-private:
-	int id_point, id_cluster;
-	vector<double> values;
-	int total_attr;
-	string name;
-
-public:
-	Point(int id_point, vector<double>& values, string name = "")
-	{
-		this->id_point = id_point;
-		total_attr = values.size();
-
-		for(int i = 0; i < total_attr; i++)
-			this->values.push_back(values[i]);
-
-		this->name = name;
-		id_cluster = -1;
-	}
-
-	int getID()
-	{
-		return id_point;
-	}
-
-	void setCluster(int id_cluster)
-	{
-		this->id_cluster = id_cluster;
-	}
-
-	int getCluster()
-	{
-		return id_cluster;
-	}
-
-	double getValue(int index)
-	{
-		return values[index];
-	}
-
-	vector<double>& getValues()
-	{
-		return values;
-	}
-
-	int getTotalValues()
-	{
-		return total_attr;
-	}
-
-	void addValue(double value)
-	{
-		values.push_back(value);
-	}
-
-	string getName()
-	{
-		return name;
-	}
-};
 
 class Cluster
 {
@@ -203,6 +146,9 @@ class KMeans
 private:
 	int K; // number of clusters
 	int total_attr, total_points, max_iterations;
+	int iterations = 0;                // of the last run()
+	long long total_us = 0, init_us = 0;
+	unique_ptr<RunRandom> rand_sequence; // draws of the initial centroids (setRandSeed)
 	vector<Cluster> clusters;
 
 	// Return ID of nearest center (uses euclidean distance)
@@ -255,7 +201,7 @@ public:
 		{
 			while(true)
 			{
-				int index_point = rand() % total_points; // Random seed is defined in main
+				int index_point = rand_sequence->next() % total_points; // seeded by setRandSeed
 
 				if(find(prohibited_indexes.begin(), prohibited_indexes.end(),
 						index_point) == prohibited_indexes.end())
@@ -271,6 +217,37 @@ public:
 		return;
 	}
 
+	// The draws rand() would make after srand(seed), without touching the global generator (libkmeans.h)
+	void setRandSeed(unsigned int seed)
+	{
+		rand_sequence.reset(new RunRandom(seed));
+	}
+
+	// Results of the last run() (libkmeans.h)
+	vector<double> getCentroids()
+	{
+		vector<double> centroids;
+		for(int i = 0; i < (int)clusters.size(); i++)
+			for(int j = 0; j < total_attr; j++)
+				centroids.push_back(clusters[i].getCentralValue(j));
+		return centroids;
+	}
+
+	int getIterations()
+	{
+		return iterations;
+	}
+
+	long long getTotalTime()
+	{
+		return total_us;
+	}
+
+	long long getInitTime()
+	{
+		return init_us;
+	}
+
 	void run(vector<Point> & points)
 	{
 		if(K > total_points)
@@ -343,92 +320,16 @@ public:
 			});
 		}
 
-		cout << "Break in iteration " << iter << "\n\n";
         auto end = chrono::high_resolution_clock::now();
-
-		// Output Results
-		for(int i = 0; i < K; i++)
-		{
-			cout << "Cluster " << clusters[i].getID() + 1 << ": ";
-			for(int j = 0; j < total_attr; j++)
-				cout << clusters[i].getCentralValue(j) << " ";
-			cout << "\n\n";
-		}
-		cout << "TOTAL EXECUTION TIME = "<<chrono::duration_cast<chrono::microseconds>(end-begin).count()<<"μs\n";
-		cout << "TIME PHASE 1 = "<<chrono::duration_cast<chrono::microseconds>(end_phase1-begin).count()<<"μs\n";
-		cout << "TIME PHASE 2 = "<<chrono::duration_cast<chrono::microseconds>(end-end_phase1).count()<<"μs\n" << endl;
-		cout << "AV TIME PER ITERATION = " << (chrono::duration_cast<chrono::microseconds>(end-begin).count() / iter) << "μs\n\n\n" << endl;
+		iterations = iter - 1; // the loop counter is one past the last pass
+		total_us = chrono::duration_cast<chrono::microseconds>(end-begin).count();
+		init_us = chrono::duration_cast<chrono::microseconds>(end_phase1-begin).count();
 	}
 };
 
-int main(int argc, char *argv[])
-{
-	string first_line;
-	getline(cin, first_line);
-
-	// IMPORTANT: Remove byte-order-mark (BOM) if it exists
-	if (first_line.size() > 0 && first_line[0] == '\xEF' && first_line[1] == '\xBB' && first_line[2] == '\xBF') {
-		first_line.erase(0, 3);
-	}
-
-	cout << "Dataset info: " << first_line << endl;
-
-	// Use stringstream to split the first line into integers
-	stringstream ss(first_line);
-	int total_points, total_attr, K, max_iterations, has_name;
-	ss >> total_points >> total_attr >> K >> max_iterations >> has_name;
-
-	if (total_points == 0 || total_attr == 0 || K == 0 || max_iterations == 0)
-	{
-		cout << "Invalid input" << endl;
-		return 1;
-	}
+} // namespace
 
-
-	vector<Point> points;
-	string point_name;
-
-	for(int i = 0; i < total_points; i++)
-	{
-		vector<double> values;
-
-		for(int j = 0; j < total_attr; j++)
-		{
-			double value;
-			cin >> value;
-			values.push_back(value);
-		}
-
-		if(has_name)
-		{
-			cin >> point_name;
-			Point p(i, values, point_name);
-			points.push_back(p);
-		}
-		else
-		{
-			Point p(i, values);
-			points.push_back(p);
-		}
-
-		// Clear any remaining values in the line
-		cin.ignore(numeric_limits<streamsize>::max(), '\n');
-	}
-
-	vector<Point> backup_points = points; // make a backup copy
-
-	// for (int threads : {1, 2, 4, 8, 16, 32, 50, 100, 500}) {
-	// 	tbb::global_control c(tbb::global_control::max_allowed_parallelism, threads);
-		srand (123); // For reproducibility
-
-		points = backup_points; // restore the backup copy
-
-		// cout << "Threads: " << threads << endl;
-		KMeans kmeans(K, total_points, total_attr, max_iterations);
-		kmeans.run(points);
-	// }
-
-	return 0;
+unique_ptr<KMeansEngine> makeParallelSimpleEngine()
+{
+	return unique_ptr<KMeansEngine>(new PointEngine<KMeans, Point>("parallel-simple", true));
 }
-
-
@@ -0,0 +1,276 @@
+// Zero copy engine: Lloyd iterations straight on caller owned rows (float or double, any row stride), for
+// programs that already hold their points in memory (the C API, src/kmeans-c.h). Same algorithm and initial
+// centroids as parallel-simple: K distinct random rows, parallel assignment into thread local sums and counts,
+// merge, new centroids. Distances and sums are in double whatever the input type.
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <stdlib.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include "libkmeans.h"
+
+using namespace std;
+
+namespace
+{
+
+template <class T>
+class StridedKMeans
+{
+private:
+	const KMeansMatrix& matrix;
+	int K; // number of clusters
+	int total_attr, total_points, max_iterations;
+	vector<double> centroids;          // K x total_attr
+	vector<int> labels;                // -1 until a point is assigned
+	int iterations = 0;                // of the last run()
+	bool cancelled = false;
+	RunRandom random;                  // draws of the initial centroids
+	long long total_us = 0, init_us = 0;
+
+	// What one thread collects during a pass
+	struct Accumulator
+	{
+		vector<double> sums;           // K x total_attr
+		vector<int> counts;
+		long long changed = 0;
+		double inertia = 0.0;
+	};
+
+	int findNearestCentroid(const T* row, double& min_dist)
+	{
+		int nearest = 0;
+		min_dist = numeric_limits<double>::max();
+		for(int c = 0; c < K; c++)
+		{
+			const double* centroid = &centroids[(size_t)c * total_attr];
+			double sum = 0.0;
+			for(int j = 0; j < total_attr; j++)
+			{
+				double diff = centroid[j] - row[j];
+				sum += diff * diff;
+			}
+			if(sum < min_dist)
+			{
+				min_dist = sum;
+				nearest = c;
+			}
+		}
+		return nearest;
+	}
+
+	void initializeClusterCentroids()
+	{
+		// K distinct random rows, the same draws as the rand() based engines make after srand(seed)
+		vector<int> prohibited_indexes;
+		for(int i = 0; i < K; i++)
+		{
+			while(true)
+			{
+				int index_point = random.next() % total_points;
+
+				if(find(prohibited_indexes.begin(), prohibited_indexes.end(),
+						index_point) == prohibited_indexes.end())
+				{
+					prohibited_indexes.push_back(index_point);
+					labels[index_point] = i;
+					const T* row = matrix.row<T>(index_point);
+					copy(row, row + total_attr, &centroids[(size_t)i * total_attr]);
+					break;
+				}
+			}
+		}
+	}
+
+public:
+	StridedKMeans(const KMeansMatrix& matrix, int K, int max_iterations, unsigned int seed) : matrix(matrix), random(seed)
+	{
+		this->K = K;
+		this->total_points = matrix.total_points;
+		this->total_attr = matrix.total_attr;
+		this->max_iterations = max_iterations;
+	}
+
+	void run(const function<bool(const KMeansProgress&)>& progress)
+	{
+		if(K > total_points)
+			return;
+
+		auto begin = chrono::high_resolution_clock::now();
+		centroids.assign((size_t)K * total_attr, 0.0);
+		labels.assign(total_points, -1);
+		initializeClusterCentroids();
+		auto end_phase1 = chrono::high_resolution_clock::now();
+
+		tbb::enumerable_thread_specific<Accumulator> accumulators;
+		int iter = 1;
+		bool done = false;
+		cancelled = false;
+		for(; !done && iter <= max_iterations; iter++)
+		{
+			for(auto& local : accumulators)
+			{
+				fill(local.sums.begin(), local.sums.end(), 0.0);
+				fill(local.counts.begin(), local.counts.end(), 0);
+				local.changed = 0;
+				local.inertia = 0.0;
+			}
+
+			// P1. Assignment, rows read where the caller keeps them
+			tbb::parallel_for(tbb::blocked_range<int>(0, total_points), [&](const tbb::blocked_range<int>& r) {
+				Accumulator& local = accumulators.local();
+				if(local.counts.empty())
+				{
+					local.sums.assign((size_t)K * total_attr, 0.0);
+					local.counts.assign(K, 0);
+				}
+				for(int i = r.begin(); i < r.end(); i++)
+				{
+					const T* row = matrix.row<T>(i);
+					double min_dist;
+					int nearest = findNearestCentroid(row, min_dist);
+					local.inertia += min_dist;
+					if(labels[i] != nearest)
+					{
+						labels[i] = nearest;
+						local.changed++;
+					}
+
+					double* sums = &local.sums[(size_t)nearest * total_attr];
+					for(int j = 0; j < total_attr; j++)
+						sums[j] += row[j];
+					local.counts[nearest]++;
+				}
+			});
+
+			// P3. Merge the thread local parts
+			KMeansProgress state = { iter, 0, 0.0 };
+			vector<double> sums((size_t)K * total_attr, 0.0);
+			vector<int> counts(K, 0);
+			for(const auto& local : accumulators)
+			{
+				if(local.counts.empty())
+					continue; // thread joined after the last range was taken
+				for(size_t v = 0; v < sums.size(); v++)
+					sums[v] += local.sums[v];
+				for(int c = 0; c < K; c++)
+					counts[c] += local.counts[c];
+				state.changed += local.changed;
+				state.inertia += local.inertia;
+			}
+			done = state.changed == 0;
+
+			// P2. New centroids (an empty cluster keeps its centroid)
+			tbb::parallel_for(0, K, 1, [&](int c) {
+				if(counts[c] <= 0)
+					return;
+				for(int j = 0; j < total_attr; j++)
+					centroids[(size_t)c * total_attr + j] = sums[(size_t)c * total_attr + j] / counts[c];
+			});
+
+			if(progress && !progress(state) && !done)
+				done = cancelled = true; // iter still counts this pass
+		}
+
+		auto end = chrono::high_resolution_clock::now();
+		iterations = iter - 1; // the loop counter is one past the last pass
+		total_us = chrono::duration_cast<chrono::microseconds>(end-begin).count();
+		init_us = chrono::duration_cast<chrono::microseconds>(end_phase1-begin).count();
+	}
+
+	// Results of the last run() (libkmeans.h)
+	vector<double>& getCentroids()
+	{
+		return centroids;
+	}
+
+	vector<int>& getLabels()
+	{
+		return labels;
+	}
+
+	int getIterations()
+	{
+		return iterations;
+	}
+
+	bool isCancelled()
+	{
+		return cancelled;
+	}
+
+	long long getTotalTime()
+	{
+		return total_us;
+	}
+
+	long long getInitTime()
+	{
+		return init_us;
+	}
+};
+
+class ParallelStridedEngine : public KMeansEngine
+{
+private:
+	template <class T>
+	KMeansResult runRows(const KMeansMatrix& matrix, const KMeansOptions& options)
+	{
+		StridedKMeans<T> kmeans(matrix, options.K, options.max_iterations, options.seed);
+		kmeans.run(options.progress);
+
+		KMeansResult result;
+		result.centroids.swap(kmeans.getCentroids());
+		result.labels.swap(kmeans.getLabels());
+		result.iterations = kmeans.getIterations();
+		result.total_us = kmeans.getTotalTime();
+		result.init_us = kmeans.getInitTime();
+		result.cancelled = kmeans.isCancelled();
+		return result;
+	}
+
+public:
+	const char* name() const override
+	{
+		return "parallel-strided";
+	}
+
+	bool parallel() const override
+	{
+		return true;
+	}
+
+	bool reportsProgress() const override
+	{
+		return true;
+	}
+
+	// Loaded datasets are dense double rows
+	KMeansResult run(const KMeansDataset& data, const KMeansOptions& options) override
+	{
+		KMeansMatrix matrix;
+		matrix.data = data.values.data();
+		matrix.total_points = data.total_points;
+		matrix.total_attr = data.total_attr;
+		matrix.row_stride = data.total_attr * sizeof(double);
+		return runMatrix(matrix, options);
+	}
+
+	KMeansResult runMatrix(const KMeansMatrix& matrix, const KMeansOptions& options) override
+	{
+		return matrix.is_float ? runRows<float>(matrix, options) : runRows<double>(matrix, options);
+	}
+};
+
+} // namespace
+
+unique_ptr<KMeansEngine> makeParallelStridedEngine()
+{
+	return unique_ptr<KMeansEngine>(new ParallelStridedEngine());
+}
@@ -13,70 +13,13 @@
 #include <numeric>
 #include <unordered_map>
 #include <memory> // for std::unique_ptr
+#include "libkmeans.h"
+#include "point.h"
 
 using namespace std;
 
-class Point
+namespace
 {
-private:
-	int id_point, id_cluster;
-	vector<double> values;
-	int total_attr;
-	string name;
-
-public:
-	Point(int id_point, vector<double>& values, string name = "")
-	{
-		this->id_point = id_point;
-		total_attr = values.size();
-
-		for(int i = 0; i < total_attr; i++)
-			this->values.push_back(values[i]);
-
-		this->name = name;
-		id_cluster = -1;
-	}
-
-	int getID()
-	{
-		return id_point;
-	}
-
-	void setCluster(int id_cluster)
-	{
-		this->id_cluster = id_cluster;
-	}
-
-	int getCluster()
-	{
-		return id_cluster;
-	}
-
-	double getValue(int index)
-	{
-		return values[index];
-	}
-
-	vector<double>& getValues()
-	{
-		return values;
-	}
-
-	int getTotalValues()
-	{
-		return total_attr;
-	}
-
-	void addValue(double value)
-	{
-		values.push_back(value);
-	}
-
-	string getName()
-	{
-		return name;
-	}
-};
 
 class Cluster
 {
@@ -204,6 +147,9 @@ class KMeans
 private:
 	int K; // number of clusters
 	int total_attr, total_points, max_iterations;
+	int iterations = 0;                // of the last run()
+	long long total_us = 0, init_us = 0;
+	unique_ptr<RunRandom> rand_sequence; // draws of the initial centroids (setRandSeed)
 	vector<Cluster> clusters;
 
 	// return ID of nearest center (uses euclidean distance)
@@ -280,7 +226,7 @@ public:
 		{
 			while(true)
 			{
-				int index_point = rand() % total_points; // Random seed is defined in main
+				int index_point = rand_sequence->next() % total_points; // seeded by setRandSeed
 
 				if(find(prohibited_indexes.begin(), prohibited_indexes.end(),
 						index_point) == prohibited_indexes.end())
@@ -296,6 +242,37 @@ public:
 		return;
 	}
 
+	// The draws rand() would make after srand(seed), without touching the global generator (libkmeans.h)
+	void setRandSeed(unsigned int seed)
+	{
+		rand_sequence.reset(new RunRandom(seed));
+	}
+
+	// Results of the last run() (libkmeans.h)
+	vector<double> getCentroids()
+	{
+		vector<double> centroids;
+		for(int i = 0; i < (int)clusters.size(); i++)
+			for(int j = 0; j < total_attr; j++)
+				centroids.push_back(clusters[i].getCentralValue(j));
+		return centroids;
+	}
+
+	int getIterations()
+	{
+		return iterations;
+	}
+
+	long long getTotalTime()
+	{
+		return total_us;
+	}
+
+	long long getInitTime()
+	{
+		return init_us;
+	}
+
 	void run(vector<Point> & points)
 	{
 		if(K > total_points)
@@ -341,83 +318,16 @@ public:
 				clusters[i].clearAttributeSums();
 			}
 		}
-		cout << "Break in iteration " << iter << "\n\n";
         auto end = chrono::high_resolution_clock::now();
-
-
-		// Output Results
-		for(int i = 0; i < K; i++)
-		{
-
-			cout << "Cluster " << clusters[i].getID() + 1 << ": ";
-			for(int j = 0; j < total_attr; j++)
-				cout << clusters[i].getCentralValue(j) << " ";
-			cout << "\n\n";
-		}
-		cout << "TOTAL EXECUTION TIME = "<<chrono::duration_cast<chrono::microseconds>(end-begin).count()<<"μs\n";
-		cout << "TIME PHASE 1 = "<<chrono::duration_cast<chrono::microseconds>(end_phase1-begin).count()<<"μs\n";
-		cout << "TIME PHASE 2 = "<<chrono::duration_cast<chrono::microseconds>(end-end_phase1).count()<<"μs\n" << endl;
-		cout << "AV TIME PER ITERATION = " << (chrono::duration_cast<chrono::microseconds>(end-begin).count() / iter) << "μs\n\n\n" << endl;
+		iterations = iter - 1; // the loop counter is one past the last pass
+		total_us = chrono::duration_cast<chrono::microseconds>(end-begin).count();
+		init_us = chrono::duration_cast<chrono::microseconds>(end_phase1-begin).count();
 	}
 };
 
-int main(int argc, char *argv[])
-{
-	srand (123); // Set seed for reproducibility
-
-	string first_line;
-	getline(cin, first_line);
+} // namespace
 
-	// IMPORTANT: Remove BOM if it exists
-	if (first_line.size() > 0 && first_line[0] == '\xEF' && first_line[1] == '\xBB' && first_line[2] == '\xBF') {
-		first_line.erase(0, 3);
-	}
-
-	// Print dataset info
-	cout << "Dataset info: " << first_line << endl;
-
-	// Use stringstream to split the first line into integers
-	stringstream ss(first_line);
-	int total_points, total_attr, K, max_iterations, has_name;
-	ss >> total_points >> total_attr >> K >> max_iterations >> has_name;
-
-
-	if (total_points == 0 || total_attr == 0 || K == 0 || max_iterations == 0)
-	{
-		cout << "Invalid input" << endl;
-		return 1;
-	}
-
-	// Read in points from dataset
-	vector<Point> points;
-	string point_name;
-	for(int i = 0; i < total_points; i++)
-	{
-		vector<double> values;
-
-		for(int j = 0; j < total_attr; j++)
-		{
-			double value;
-			cin >> value;
-			values.push_back(value);
-		}
-
-		if(has_name)
-		{
-			cin >> point_name;
-			Point p(i, values, point_name);
-			points.push_back(p);
-		}
-		else
-		{
-			Point p(i, values);
-			points.push_back(p);
-		}
-
-		// Clear any remaining values in the line
-		cin.ignore(numeric_limits<streamsize>::max(), '\n');
-	}
-	KMeans kmeans(K, total_points, total_attr, max_iterations);
-	kmeans.run(points);
-	return 0;
+unique_ptr<KMeansEngine> makeSerialFastUnrollEngine()
+{
+	return unique_ptr<KMeansEngine>(new PointEngine<KMeans, Point>("serial-fast-unroll", false));
 }
@@ -0,0 +1,139 @@
+// bin/kmeans: one front end for every engine in libkmeans (src/libkmeans.h).
+// The engine comes from --engine=NAME, or from the name the binary was started as (bin/kmeans-serial is a link
+// to bin/kmeans and runs the serial engine), parallel-fast otherwise. --threads, --k, --max-iter, --seed and
+// --labels-out work with every engine; anything else is an option of the engine (only parallel-fast has any).
+//
+//   cat datasets/bean.txt | bin/kmeans --engine=serial-fast --k=12 --seed=7
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <memory>
+#include <tbb/global_control.h>
+#include "libkmeans.h"
+
+using namespace std;
+
+void printUsage(const char* program)
+{
+	cout << "Usage: cat dataset | " << program << " [--engine=NAME] [--threads=N] [--k=K] [--max-iter=N] [--seed=S] [--labels-out=FILE]"
+		<< " [engine options]\n"
+		<< "       " << program << " --list-engines\n"
+		<< "Engines:";
+	for(auto& name : engineNames())
+		cout << " " << name;
+	cout << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	// bin/kmeans-<engine> picks its engine by name
+	string program = argv[0];
+	string base = program.substr(program.find_last_of('/') + 1);
+	string engine_name = base.rfind("kmeans-", 0) == 0 ? base.substr(7) : "parallel-fast";
+
+	KMeansOptions options;
+	string labels_out;
+	bool list_engines = false;
+	vector<string> common_args, engine_args;
+	for(int a = 1; a < argc; a++)
+	{
+		string arg = argv[a];
+		if(arg.rfind("--engine=", 0) == 0)
+			engine_name = arg.substr(9);
+		else if(arg == "--list-engines")
+			list_engines = true;
+		else if(arg.rfind("--threads=", 0) == 0)
+		{
+			options.threads = stoi(arg.substr(10));
+			common_args.push_back(arg);
+		}
+		else if(arg.rfind("--k=", 0) == 0)
+		{
+			options.K = stoi(arg.substr(4));
+			common_args.push_back(arg);
+		}
+		else if(arg.rfind("--max-iter=", 0) == 0 || arg.rfind("--max-iterations=", 0) == 0) // the long form is an alias
+		{
+			options.max_iterations = stoi(arg.substr(arg.find('=') + 1));
+			common_args.push_back(arg);
+		}
+		else if(arg.rfind("--seed=", 0) == 0)
+		{
+			options.seed = stoul(arg.substr(7));
+			common_args.push_back(arg);
+		}
+		else if(arg.rfind("--labels-out=", 0) == 0)
+		{
+			labels_out = arg.substr(13);
+			common_args.push_back(arg);
+		}
+		else
+			engine_args.push_back(arg);
+	}
+
+	if(list_engines)
+	{
+		for(auto& name : engineNames())
+			cout << name << "\n";
+		return 0;
+	}
+
+	unique_ptr<KMeansEngine> engine = makeEngine(engine_name);
+	if(!engine)
+	{
+		cout << "Unknown engine: " << engine_name << endl;
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	// Engines with their own command line get all of it, in the original order of the options
+	if(engine->hasCommandLine())
+	{
+		vector<char*> args = { argv[0] };
+		for(int a = 1; a < argc; a++)
+		{
+			string arg = argv[a];
+			if(arg.rfind("--engine=", 0) != 0)
+				args.push_back(argv[a]);
+		}
+		args.push_back(nullptr);
+		return engine->runCommandLine(args.size() - 1, args.data());
+	}
+
+	if(!engine_args.empty())
+	{
+		cout << "Unknown option for engine " << engine->name() << ": " << engine_args[0] << endl;
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	unique_ptr<tbb::global_control> thread_limit;
+	if(options.threads > 0)
+		thread_limit.reset(new tbb::global_control(tbb::global_control::max_allowed_parallelism, options.threads));
+
+	KMeansDataset data;
+	if(!readDatasetHeader(cin, data))
+		return 1;
+
+	auto begin_load = chrono::high_resolution_clock::now();
+	if(!readDatasetValues(cin, data))
+	{
+		cout << "Truncated dataset" << endl;
+		return 1;
+	}
+	auto end_load = chrono::high_resolution_clock::now();
+	cout << "LOAD TIME = " << chrono::duration_cast<chrono::microseconds>(end_load-begin_load).count() << "μs" << endl;
+
+	if(options.K <= 0)
+		options.K = data.K;
+	if(options.max_iterations <= 0)
+		options.max_iterations = data.max_iterations;
+
+	KMeansResult result = engine->run(data, options);
+	printResult(cout, result, data.total_attr);
+	if(!labels_out.empty() && !writeLabels(labels_out, result.labels))
+		return 1;
+	return 0;
+}
@@ -0,0 +1,144 @@
+// Engine registry, dataset loading and the result report shared by all engines (see libkmeans.h)
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <limits>
+#include <algorithm>
+#include "libkmeans.h"
+#include "binary-points.h"
+
+using namespace std;
+
+// One factory per engine translation unit
+unique_ptr<KMeansEngine> makeSerialEngine();
+unique_ptr<KMeansEngine> makeSerialFastEngine();
+unique_ptr<KMeansEngine> makeSerialFastUnrollEngine();
+unique_ptr<KMeansEngine> makeSerialFastNoClusterEngine();
+unique_ptr<KMeansEngine> makeParallelSimpleEngine();
+unique_ptr<KMeansEngine> makeParallelFastEngine();
+unique_ptr<KMeansEngine> makeParallelStridedEngine();
+
+typedef unique_ptr<KMeansEngine> (*EngineFactory)();
+
+const pair<const char*, EngineFactory> ENGINES[] = {
+	{ "serial", makeSerialEngine },
+	{ "serial-fast", makeSerialFastEngine },
+	{ "serial-fast-unroll", makeSerialFastUnrollEngine },
+	{ "serial-fast-no-cluster", makeSerialFastNoClusterEngine },
+	{ "parallel-simple", makeParallelSimpleEngine },
+	{ "parallel-fast", makeParallelFastEngine },
+	{ "parallel-strided", makeParallelStridedEngine },
+};
+
+vector<string> engineNames()
+{
+	vector<string> names;
+	for(auto& engine : ENGINES)
+		names.push_back(engine.first);
+	return names;
+}
+
+unique_ptr<KMeansEngine> makeEngine(const string& name)
+{
+	for(auto& engine : ENGINES)
+		if(name == engine.first)
+			return engine.second();
+	return nullptr;
+}
+
+bool readDatasetHeader(istream& in, KMeansDataset& data)
+{
+	data.binary = isBinaryPoints(in);
+	if(data.binary)
+	{
+		BinaryPointsHeader header;
+		if(!readBinaryPointsHeader(in, header) || header.total_points > INT32_MAX)
+		{
+			cout << "Invalid binary dataset header" << endl;
+			return false;
+		}
+		data.header = to_string(header.total_points) + " " + to_string(header.total_attr) + " "
+			+ to_string(header.K) + " " + to_string(header.max_iterations) + " 0";
+	}
+	else
+		getline(in, data.header);
+
+	// IMPORTANT: Remove byte-order-mark (BOM) if it exists
+	if(data.header.size() >= 3 && data.header.compare(0, 3, "\xEF\xBB\xBF") == 0)
+		data.header.erase(0, 3);
+
+	cout << "Dataset info: " << data.header << endl;
+
+	stringstream ss(data.header);
+	int has_name = 0;
+	data.total_points = data.total_attr = data.K = data.max_iterations = 0;
+	ss >> data.total_points >> data.total_attr >> data.K >> data.max_iterations >> has_name;
+	data.has_name = has_name != 0;
+	if(data.total_points <= 0 || data.total_attr <= 0 || data.K <= 0 || data.max_iterations <= 0)
+	{
+		cout << "Invalid input" << endl;
+		return false;
+	}
+	return true;
+}
+
+bool readDatasetValues(istream& in, KMeansDataset& data)
+{
+	data.values.resize((size_t)data.total_points * data.total_attr);
+	if(data.binary)
+		return (bool)in.read((char*)data.values.data(), data.values.size() * sizeof(double));
+
+	if(data.has_name)
+		data.names.resize(data.total_points);
+	for(int i = 0; i < data.total_points; i++)
+	{
+		for(int j = 0; j < data.total_attr; j++)
+			in >> data.values[(size_t)i * data.total_attr + j];
+		if(data.has_name)
+			in >> data.names[i];
+		if(in.fail())
+			return false; // fewer rows or values than the header says
+
+		// Clear any remaining values in the line
+		in.ignore(numeric_limits<streamsize>::max(), '\n');
+	}
+	return true;
+}
+
+void printResult(ostream& out, const KMeansResult& result, int total_attr)
+{
+	if(result.centroids.empty())
+		return; // K > total_points, nothing was run
+
+	int K = result.centroids.size() / total_attr;
+	out << "Break in iteration " << result.iterations << "\n\n";
+	for(int i = 0; i < K; i++)
+	{
+		out << "Cluster " << i + 1 << ": ";
+		for(int j = 0; j < total_attr; j++)
+			out << result.centroids[(size_t)i * total_attr + j] << " ";
+		out << "\n\n";
+	}
+	out << "TOTAL EXECUTION TIME = " << result.total_us << "μs\n";
+	out << "TIME PHASE 1 = " << result.init_us << "μs\n";
+	out << "TIME PHASE 2 = " << result.total_us - result.init_us << "μs\n" << endl;
+	out << "AV TIME PER ITERATION = " << result.total_us / max(1, result.iterations) << "μs\n\n\n" << endl;
+}
+
+bool writeLabels(const string& path, const vector<int>& labels, bool binary)
+{
+	ofstream out(path, binary ? ios::binary : ios::out);
+	if(binary)
+		out.write((const char*)labels.data(), labels.size() * sizeof(int));
+	else
+		for(int label : labels)
+			out << label << "\n";
+	if(!out)
+	{
+		cout << "Cannot write labels to " << path << endl;
+		return false;
+	}
+	cout << "Labels written to " << path << (binary ? " (int32)" : "") << "\n";
+	return true;
+}
@@ -0,0 +1,251 @@
+// libkmeans: every k-means engine of this repo behind one interface (bin/libkmeans.a).
+// Each engine is its own translation unit (src/kmeans-<engine>.cpp, built with its own flags) and registers
+// a factory in libkmeans.cpp; bin/kmeans (src/kmeans.cpp) picks one at run time, the old per-engine binaries
+// are bin/kmeans under another name. Loading, the timing report and the option handling live here once.
+
+#ifndef KMEANS_LIBKMEANS_H
+#define KMEANS_LIBKMEANS_H
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+using namespace std;
+
+// A dataset as read from the usual "N D K iterations has_name" text format or the binary format
+struct KMeansDataset
+{
+	string header;                 // first line as given (binary: rebuilt from the header fields)
+	int total_points = 0, total_attr = 0;
+	int K = 0, max_iterations = 0; // what the file asks for
+	bool has_name = false;
+	bool binary = false;
+	vector<double> values;         // total_points * total_attr, row major
+	vector<string> names;          // when has_name
+};
+
+// Caller owned rows, read in place by the engines that can (zero copy, see KMeansEngine::runMatrix).
+// Attributes of a row are contiguous, rows are row_stride bytes apart.
+struct KMeansMatrix
+{
+	const void* data = nullptr;
+	bool is_float = false;         // float rows, double otherwise
+	int total_points = 0, total_attr = 0;
+	size_t row_stride = 0;
+
+	template <class T>
+	const T* row(int i) const
+	{
+		return (const T*)((const char*)data + (size_t)i * row_stride);
+	}
+};
+
+// The rand() sequence srand(seed) starts, private to one run (glibc random_r on a state of its own), so runs on
+// different threads neither race on the global generator nor change each other's draws
+class RunRandom
+{
+private:
+	random_data data;
+	char state[128]; // size of the default generator behind rand()
+
+public:
+	RunRandom(unsigned int seed)
+	{
+		memset(&data, 0, sizeof(data));
+		initstate_r(seed, state, sizeof(state), &data);
+	}
+
+	RunRandom(const RunRandom&) = delete; // data points into state
+	RunRandom& operator=(const RunRandom&) = delete;
+
+	int next()
+	{
+		int32_t value;
+		random_r(&data, &value);
+		return value;
+	}
+};
+
+// State after a Lloyd pass
+struct KMeansProgress
+{
+	int iteration;
+	long long changed;             // points that changed cluster in this pass
+	double inertia;                // sum of squared distances to the centroids the points were assigned to
+};
+
+struct KMeansOptions
+{
+	int K = 0;
+	int max_iterations = 0;
+	unsigned int seed = 123;       // seed of the initial centroid draw (the rand() sequence of srand(seed))
+	int threads = 0;               // 0 = TBB default (parallel engines only)
+
+	// Called after every Lloyd pass by the engines that report progress; returning false stops the run there
+	// (result.cancelled). Runs on the thread that called run().
+	function<bool(const KMeansProgress&)> progress;
+};
+
+struct KMeansResult
+{
+	vector<double> centroids;      // K * total_attr, empty when K > total_points
+	vector<int> labels;            // cluster of every point
+	int iterations = 0;            // Lloyd passes, the converged one included
+	long long total_us = 0;        // run() without loading
+	long long init_us = 0;         // initial centroids (phase 1)
+	bool cancelled = false;        // options.progress stopped it
+};
+
+class KMeansEngine
+{
+public:
+	virtual ~KMeansEngine() {}
+
+	virtual const char* name() const = 0;
+
+	// Uses options.threads (the caller sets up tbb::global_control)
+	virtual bool parallel() const
+	{
+		return false;
+	}
+
+	virtual KMeansResult run(const KMeansDataset& data, const KMeansOptions& options) = 0;
+
+	// Same run on caller owned rows. By default they are copied into a KMeansDataset first; zero copy engines
+	// and PointEngine override this.
+	virtual KMeansResult runMatrix(const KMeansMatrix& matrix, const KMeansOptions& options)
+	{
+		KMeansDataset data;
+		data.total_points = matrix.total_points;
+		data.total_attr = matrix.total_attr;
+		data.values.resize((size_t)matrix.total_points * matrix.total_attr);
+		for(int i = 0; i < matrix.total_points; i++)
+		{
+			double* values = &data.values[(size_t)i * matrix.total_attr];
+			if(matrix.is_float)
+				copy(matrix.row<float>(i), matrix.row<float>(i) + matrix.total_attr, values);
+			else
+				copy(matrix.row<double>(i), matrix.row<double>(i) + matrix.total_attr, values);
+		}
+		return run(data, options);
+	}
+
+	// Calls options.progress after every pass (and so can be cancelled)
+	virtual bool reportsProgress() const
+	{
+		return false;
+	}
+
+	// Engines with modes beyond a plain run parse their own command line (argv[0] included, --threads / --k /
+	// --max-iter / --seed passed on) and do the whole job, reading stdin and printing, in runCommandLine
+	virtual bool hasCommandLine() const
+	{
+		return false;
+	}
+
+	virtual int runCommandLine(int /* argc */, char* /* argv */[])
+	{
+		return 1;
+	}
+};
+
+vector<string> engineNames();
+unique_ptr<KMeansEngine> makeEngine(const string& name); // null for an unknown name
+
+// Header line (prints "Dataset info: ..." like every engine did), then the points
+bool readDatasetHeader(istream& in, KMeansDataset& data);
+bool readDatasetValues(istream& in, KMeansDataset& data);
+
+// Break in iteration / centroids / TOTAL EXECUTION TIME / TIME PHASE 1, 2 / AV TIME PER ITERATION
+void printResult(ostream& out, const KMeansResult& result, int total_attr);
+
+// --labels-out: one label per line, or int32 values when binary; false (and a message) if the file can't be written
+bool writeLabels(const string& path, const vector<int>& labels, bool binary = false);
+
+// Adapter for the engines built on Point objects + a KMeans class with setRandSeed(seed), run(points),
+// getCentroids(), getIterations(), getTotalTime(), getInitTime(). setRandSeed gives the run its own RunRandom, so
+// runs on different threads don't share the global rand() state.
+// PointType(id, const double* row, total_attr, name) is built straight on the rows of the dataset or matrix:
+// the engines of point.h keep a pointer to the row, parallel-fast copies it once (it rescales and merges its points).
+template <class KMeansType, class PointType>
+class PointEngine : public KMeansEngine
+{
+private:
+	const char* engine_name;
+	bool is_parallel;
+
+	KMeansResult runPoints(vector<PointType>& points, int total_attr, const KMeansOptions& options)
+	{
+		int total_points = points.size();
+		KMeansType kmeans(options.K, total_points, total_attr, options.max_iterations);
+		kmeans.setRandSeed(options.seed);
+		configure(kmeans, options);
+		kmeans.run(points);
+
+		KMeansResult result;
+		result.centroids = kmeans.getCentroids();
+		result.labels.resize(total_points);
+		for(int i = 0; i < total_points; i++)
+			result.labels[i] = points[i].getCluster();
+		result.iterations = kmeans.getIterations();
+		result.total_us = kmeans.getTotalTime();
+		result.init_us = kmeans.getInitTime();
+		collect(kmeans, result);
+		return result;
+	}
+
+protected:
+	// Engine specific settings before run() (e.g. silencing an engine that prints its own report) and results
+	// beyond the common ones after it
+	virtual void configure(KMeansType& /* kmeans */, const KMeansOptions& /* options */) {}
+	virtual void collect(KMeansType& /* kmeans */, KMeansResult& /* result */) {}
+
+public:
+	PointEngine(const char* engine_name, bool is_parallel) : engine_name(engine_name), is_parallel(is_parallel) {}
+
+	const char* name() const override
+	{
+		return engine_name;
+	}
+
+	bool parallel() const override
+	{
+		return is_parallel;
+	}
+
+	KMeansResult run(const KMeansDataset& data, const KMeansOptions& options) override
+	{
+		vector<PointType> points;
+		points.reserve(data.total_points);
+		for(int i = 0; i < data.total_points; i++)
+			points.push_back(PointType(i, &data.values[(size_t)i * data.total_attr], data.total_attr,
+				data.names.empty() ? "" : data.names[i]));
+		return runPoints(points, data.total_attr, options);
+	}
+
+	// Double rows are used where they are, float rows are converted once (no KMeansDataset in between)
+	KMeansResult runMatrix(const KMeansMatrix& matrix, const KMeansOptions& options) override
+	{
+		vector<double> converted;
+		if(matrix.is_float)
+		{
+			converted.resize((size_t)matrix.total_points * matrix.total_attr);
+			for(int i = 0; i < matrix.total_points; i++)
+				copy(matrix.row<float>(i), matrix.row<float>(i) + matrix.total_attr, &converted[(size_t)i * matrix.total_attr]);
+		}
+		vector<PointType> points;
+		points.reserve(matrix.total_points);
+		for(int i = 0; i < matrix.total_points; i++)
+			points.push_back(PointType(i, matrix.is_float ? &converted[(size_t)i * matrix.total_attr] : matrix.row<double>(i),
+				matrix.total_attr));
+		return runPoints(points, matrix.total_attr, options);
+	}
+};
+
+#endif
@@ -0,0 +1,65 @@
+// Memory accounting: what the big structures of a run really take on the heap (allocator overhead included),
+// next to the peak RSS of the process. KMeans::measureMemory fills a MemoryFootprint from the live structures
+// after run(), KMeans::estimateMemory predicts the same items from N, D, K and the engine (--dry-run).
+
+#ifndef KMEANS_MEMORY_FOOTPRINT_H
+#define KMEANS_MEMORY_FOOTPRINT_H
+
+#include <vector>
+#include <string>
+#include <ostream>
+#include <algorithm>
+#include <stddef.h>
+#include <sys/resource.h>
+
+using namespace std;
+
+// glibc malloc: 8 byte chunk header, 16 byte granularity, 32 byte minimum chunk
+inline size_t heapBlockBytes(size_t requested)
+{
+	if(requested == 0)
+		return 0;
+	return max<size_t>(32, (requested + 8 + 15) & ~(size_t)15);
+}
+
+template <class T>
+inline size_t vectorHeapBytes(const vector<T>& v)
+{
+	return heapBlockBytes(v.capacity() * sizeof(T));
+}
+
+// Short strings live inside the string object (libstdc++ SSO holds 15 chars)
+inline size_t stringHeapBytes(size_t length)
+{
+	return length > 15 ? heapBlockBytes(length + 1) : 0;
+}
+
+// Linux reports ru_maxrss in KB
+inline size_t peakRssBytes()
+{
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+	return (size_t)usage.ru_maxrss * 1024;
+}
+
+struct MemoryFootprint
+{
+	size_t dataset = 0;       // points (objects, values, names), quantized copy
+	size_t labels = 0;        // per point cluster ids kept next to the points
+	size_t accumulators = 0;  // thread local diffs + attribute sums of the Lloyd loop, all threads
+	size_t model = 0;         // centroids, sums, counts, centroid index
+
+	size_t total() const
+	{
+		return dataset + labels + accumulators + model;
+	}
+
+	void print(ostream& out, const string& title) const
+	{
+		out << title << ": dataset " << dataset / 1e6 << " MB, labels " << labels / 1e6 << " MB, thread local accumulators "
+			<< accumulators / 1e6 << " MB, model " << model / 1e6 << " MB, total " << total() / 1e6 << " MB\n";
+	}
+};
+
+#endif
@@ -0,0 +1,335 @@
+// Hardware counters per KMeans::run phase and per TBB worker (enabled with KMeans::setCounters).
+// Every thread opens its own perf_event_open group on first use: cycles, instructions and last level cache
+// misses, user space only. A task samples the group when it starts and adds the difference to its thread's
+// totals for the phase when it ends. LLC misses * 64 bytes is taken as the traffic from memory.
+// When the kernel multiplexes the PMU between more events than it has counters, the group only counts part of
+// the time: each difference is scaled by the time the group was enabled over the time it was running.
+//
+// The roofline is measured on the host (measureRoofline): peak GB/s from a parallel triad over arrays well
+// past the LLC, peak GFLOP/s from independent multiply-add chains. With the achieved GB/s and GFLOP/s of a
+// phase and its operational intensity (FLOP per byte from memory), the report says which roof it is under.
+//
+// Where perf_event_open is refused (no PMU in a VM, perf_event_paranoid, seccomp) the counters report why and
+// the phase table falls back to wall time + the analytic bytes and FLOPs run() declares for each phase.
+
+#ifndef KMEANS_PERF_COUNTERS_H
+#define KMEANS_PERF_COUNTERS_H
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/task_arena.h>
+
+using namespace std;
+
+enum CounterPhase { PHASE_INDEX, PHASE_ASSIGN, PHASE_REDUCE, PHASE_UPDATE, TOTAL_PHASES };
+
+const char* const COUNTER_PHASE_NAMES[TOTAL_PHASES] = { "index", "assign", "reduce", "update" };
+const int CACHE_LINE_BYTES = 64;
+
+struct CounterSample
+{
+	uint64_t cycles = 0, instructions = 0, llc_misses = 0;
+	uint64_t enabled_ns = 0, running_ns = 0; // time the group was enabled / actually on the PMU
+
+	CounterSample& operator+=(const CounterSample& other)
+	{
+		cycles += other.cycles;
+		instructions += other.instructions;
+		llc_misses += other.llc_misses;
+		enabled_ns += other.enabled_ns;
+		running_ns += other.running_ns;
+		return *this;
+	}
+
+	// Counts from begin to this sample, scaled up to the whole enabled time if the group was multiplexed
+	CounterSample since(const CounterSample& begin) const
+	{
+		CounterSample d;
+		d.enabled_ns = enabled_ns - begin.enabled_ns;
+		d.running_ns = running_ns - begin.running_ns;
+		double scale = d.running_ns > 0 ? (double)d.enabled_ns / d.running_ns : 1.0;
+		d.cycles = (uint64_t)((cycles - begin.cycles) * scale + 0.5);
+		d.instructions = (uint64_t)((instructions - begin.instructions) * scale + 0.5);
+		d.llc_misses = (uint64_t)((llc_misses - begin.llc_misses) * scale + 0.5);
+		return d;
+	}
+};
+
+// One perf event group on the calling thread
+class ThreadCounters
+{
+private:
+	int fds[3] = { -1, -1, -1 };
+	int error = 0;
+
+	static int open(uint64_t config, int group_fd)
+	{
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = config;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0); // this thread, any CPU
+	}
+
+public:
+	int worker;                           // TBB worker slot of the thread
+	CounterSample totals[TOTAL_PHASES];
+	long long tasks[TOTAL_PHASES] = {};
+
+	ThreadCounters() : worker(max(tbb::this_task_arena::current_thread_index(), 0))
+	{
+		const uint64_t configs[3] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES };
+		for(int e = 0; e < 3; e++)
+		{
+			fds[e] = open(configs[e], e == 0 ? -1 : fds[0]);
+			if(fds[e] < 0)
+			{
+				error = errno;
+				close();
+				return;
+			}
+		}
+	}
+
+	ThreadCounters(const ThreadCounters&) = delete;
+	ThreadCounters& operator=(const ThreadCounters&) = delete;
+
+	~ThreadCounters()
+	{
+		close();
+	}
+
+	void close()
+	{
+		for(int& fd : fds)
+		{
+			if(fd >= 0)
+				::close(fd);
+			fd = -1;
+		}
+	}
+
+	bool available() const
+	{
+		return fds[0] >= 0;
+	}
+
+	int getError() const
+	{
+		return error;
+	}
+
+	CounterSample sample() const
+	{
+		CounterSample s;
+		uint64_t values[6]; // nr, time enabled, time running, one value per event
+		if(available() && read(fds[0], values, sizeof(values)) == (ssize_t)sizeof(values))
+		{
+			s.enabled_ns = values[1];
+			s.running_ns = values[2];
+			s.cycles = values[3];
+			s.instructions = values[4];
+			s.llc_misses = values[5];
+		}
+		return s;
+	}
+};
+
+struct Roofline
+{
+	double peak_gflops = 0.0;
+	double peak_gbps = 0.0;
+};
+
+// Best of a few repetitions of each kernel, on all threads the arena allows
+inline Roofline measureRoofline()
+{
+	Roofline roofline;
+	int threads = tbb::this_task_arena::max_concurrency();
+
+	// Triad a = b + s * c over 3 x 64MB: 2 reads + 1 write per element (write allocate not counted)
+	size_t n = (size_t)8 << 20;
+	vector<double> a(n, 0.0), b(n, 1.0), c(n, 2.0);
+	for(int r = 0; r < 5; r++)
+	{
+		auto begin = chrono::high_resolution_clock::now();
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, n), [&](const tbb::blocked_range<size_t>& range) {
+			for(size_t i = range.begin(); i < range.end(); i++)
+				a[i] = b[i] + 0.5 * c[i];
+		});
+		auto end = chrono::high_resolution_clock::now();
+		double ns = chrono::duration_cast<chrono::nanoseconds>(end - begin).count();
+		roofline.peak_gbps = max(roofline.peak_gbps, 3.0 * n * sizeof(double) / ns);
+	}
+
+	// 32 independent acc = acc * m + k chains per thread, 2 FLOP each, vectorized by the compiler
+	const int chains = 32, steps = 1 << 21;
+	vector<double> sink(threads);
+	for(int r = 0; r < 3; r++)
+	{
+		auto begin = chrono::high_resolution_clock::now();
+		tbb::parallel_for(0, threads, 1, [&](int t) {
+			double acc[chains];
+			for(int j = 0; j < chains; j++)
+				acc[j] = 1.0 + j * 1e-3;
+			for(int s = 0; s < steps; s++)
+				for(int j = 0; j < chains; j++)
+					acc[j] = acc[j] * 0.999999 + 1e-6;
+			double sum = 0.0;
+			for(int j = 0; j < chains; j++)
+				sum += acc[j];
+			sink[t] = sum; // keeps the loop alive
+		});
+		auto end = chrono::high_resolution_clock::now();
+		double ns = chrono::duration_cast<chrono::nanoseconds>(end - begin).count();
+		roofline.peak_gflops = max(roofline.peak_gflops, 2.0 * chains * steps * threads / ns);
+	}
+	volatile double keep = 0.0;
+	for(double s : sink)
+		keep = keep + s;
+	return roofline;
+}
+
+// Start of a phase, taken on the calling thread
+struct PhaseMark
+{
+	double begin_us;
+	CounterSample sample;
+};
+
+class PhaseCounters
+{
+private:
+	chrono::high_resolution_clock::time_point origin = chrono::high_resolution_clock::now();
+	tbb::enumerable_thread_specific<ThreadCounters> threads;
+	double phase_us[TOTAL_PHASES] = {};
+	double phase_flops[TOTAL_PHASES] = {};
+	double phase_bytes[TOTAL_PHASES] = {};  // analytic, from the declared work
+
+	double now() const
+	{
+		return chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - origin).count() / 1000.0;
+	}
+
+public:
+	// This thread's counters now (the group is opened on the first call from a thread)
+	CounterSample sample()
+	{
+		return threads.local().sample();
+	}
+
+	// Count everything since begin (a sample() on the same thread) towards phase
+	void add(CounterPhase phase, const CounterSample& begin)
+	{
+		ThreadCounters& local = threads.local();
+		local.totals[phase] += local.sample().since(begin);
+		local.tasks[phase]++;
+	}
+
+	PhaseMark mark()
+	{
+		return { now(), sample() };
+	}
+
+	// A phase the calling thread ran alone: its counters since the mark, the wall time and the work done
+	// (FLOPs, bytes it has to read at least)
+	void endSerial(CounterPhase phase, const PhaseMark& begin, double flops, double bytes)
+	{
+		add(phase, begin.sample);
+		endParallel(phase, begin, flops, bytes);
+	}
+
+	// A parallel phase: its tasks counted themselves (sample/add), only wall time and work are added here
+	void endParallel(CounterPhase phase, const PhaseMark& begin, double flops, double bytes)
+	{
+		phase_us[phase] += now() - begin.begin_us;
+		phase_flops[phase] += flops;
+		phase_bytes[phase] += bytes;
+	}
+
+	bool available()
+	{
+		return threads.local().available();
+	}
+
+	void report(ostream& out, const Roofline& roofline)
+	{
+		bool hardware = available();
+		if(!hardware)
+			out << "Hardware counters unavailable (perf_event_open: " << strerror(threads.local().getError())
+				<< "), using wall time and analytic bytes\n";
+
+		if(hardware)
+		{
+			CounterSample all;
+			for(auto& local : threads)
+				for(int p = 0; p < TOTAL_PHASES; p++)
+					all += local.totals[p];
+			if(all.running_ns < all.enabled_ns)
+				out << "Counters multiplexed: on the PMU " << 100.0 * all.running_ns / max<uint64_t>(all.enabled_ns, 1)
+					<< "% of the time, counts scaled by enabled / running time\n";
+		}
+		out << "Roofline: " << roofline.peak_gflops << " GFLOP/s, " << roofline.peak_gbps << " GB/s, ridge at "
+			<< roofline.peak_gflops / roofline.peak_gbps << " FLOP/byte\n";
+		out << "PHASE\tTIME(μs)\tCYCLES\tINSTRUCTIONS\tIPC\tLLC_MISSES\tGB/S\tGFLOP/S\tFLOP/BYTE\tBOUND\n";
+		for(int p = 0; p < TOTAL_PHASES; p++)
+		{
+			CounterSample phase;
+			for(auto& local : threads)
+				phase += local.totals[p];
+			double bytes = hardware ? (double)phase.llc_misses * CACHE_LINE_BYTES : phase_bytes[p];
+			double ns = phase_us[p] * 1000.0;
+			out << COUNTER_PHASE_NAMES[p] << "\t" << phase_us[p] << "\t";
+			if(hardware)
+				out << phase.cycles << "\t" << phase.instructions << "\t"
+					<< (phase.cycles > 0 ? (double)phase.instructions / phase.cycles : 0.0) << "\t" << phase.llc_misses << "\t";
+			else
+				out << "-\t-\t-\t-\t";
+			out << (ns > 0 ? bytes / ns : 0.0) << "\t";
+			if(phase_flops[p] > 0 && ns > 0)
+			{
+				// Attainable = min(peak FLOP/s, intensity * peak bandwidth)
+				double intensity = bytes > 0 ? phase_flops[p] / bytes : 1e9;
+				bool memory_bound = intensity * roofline.peak_gbps < roofline.peak_gflops;
+				out << phase_flops[p] / ns << "\t" << intensity << "\t" << (memory_bound ? "memory" : "compute") << "\n";
+			}
+			else
+				out << "-\t-\t-\n";
+		}
+
+		if(!hardware)
+			return;
+		out << "WORKER\tPHASE\tTASKS\tCYCLES\tINSTRUCTIONS\tIPC\tLLC_MISSES\n";
+		vector<ThreadCounters*> workers;
+		for(auto& local : threads)
+			workers.push_back(&local);
+		sort(workers.begin(), workers.end(), [](ThreadCounters* a, ThreadCounters* b) { return a->worker < b->worker; });
+		for(auto worker : workers)
+			for(int p = 0; p < TOTAL_PHASES; p++)
+			{
+				if(worker->tasks[p] == 0)
+					continue;
+				const CounterSample& s = worker->totals[p];
+				out << worker->worker << "\t" << COUNTER_PHASE_NAMES[p] << "\t" << worker->tasks[p] << "\t" << s.cycles << "\t"
+					<< s.instructions << "\t" << (s.cycles > 0 ? (double)s.instructions / s.cycles : 0.0) << "\t" << s.llc_misses << "\n";
+			}
+	}
+};
+
+#endif
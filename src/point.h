@@ -0,0 +1,74 @@
+// Point of the Point based engines (serial, serial-fast, serial-fast-unroll, serial-fast-no-cluster,
+// parallel-simple): one row of a dataset the caller keeps alive for the run (KMeansDataset::values or the
+// KMeansMatrix rows, see PointEngine) and the cluster it is assigned to. The values are not copied.
+//
+// The engine translation units are built with different flags, so this is declared in an anonymous namespace
+// like the engine classes: every engine gets its own copy and the linker never merges two of them.
+
+#ifndef KMEANS_POINT_H
+#define KMEANS_POINT_H
+
+#include <string>
+
+using namespace std;
+
+namespace
+{
+
+class Point
+{
+private:
+	int id_point, id_cluster;
+	const double* values; // total_attr values owned by the caller
+	int total_attr;
+	string name;
+
+public:
+	Point(int id_point, const double* values, int total_attr, string name = "")
+	{
+		this->id_point = id_point;
+		this->values = values;
+		this->total_attr = total_attr;
+		this->name = name;
+		id_cluster = -1;
+	}
+
+	int getID()
+	{
+		return id_point;
+	}
+
+	void setCluster(int id_cluster)
+	{
+		this->id_cluster = id_cluster;
+	}
+
+	int getCluster()
+	{
+		return id_cluster;
+	}
+
+	double getValue(int index)
+	{
+		return values[index];
+	}
+
+	const double* getValues()
+	{
+		return values;
+	}
+
+	int getTotalValues()
+	{
+		return total_attr;
+	}
+
+	string getName()
+	{
+		return name;
+	}
+};
+
+} // namespace
+
+#endif
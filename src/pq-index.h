@@ -0,0 +1,216 @@
+// Product quantization of the centroids for approximate nearest-centroid search with huge K.
+// Each centroid is split into M subvectors and every subvector is replaced by the id of the closest of
+// (up to) 256 codewords. A query builds an M x 256 table of subvector distances once, scores every centroid
+// with M table lookups, then re-ranks the best few candidates with the exact distance.
+
+#ifndef KMEANS_PQ_INDEX_H
+#define KMEANS_PQ_INDEX_H
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <math.h>
+#include <tbb/parallel_for.h>
+#include "ball-tree.h" // squaredDistance
+
+using namespace std;
+
+class CentroidProductQuantizer
+{
+private:
+	static const int CODEBOOK_SIZE = 256;
+	static const int TRAIN_ITERATIONS = 8;
+
+	int K, total_attr, M, codebook_size, rerank_depth;
+	const double* centroids;       // K * total_attr, owned by KMeans
+	vector<int> sub_begin;         // M + 1 attribute offsets
+	vector<double> codewords;      // for subspace m: codebook_size * sub_dim values starting at sub_begin[m] * codebook_size
+	vector<uint8_t> codes;         // K * M
+
+	int subDim(int m) const
+	{
+		return sub_begin[m + 1] - sub_begin[m];
+	}
+
+	double* codeword(int m, int c)
+	{
+		return &codewords[(size_t)sub_begin[m] * codebook_size + (size_t)c * subDim(m)];
+	}
+
+	const double* codeword(int m, int c) const
+	{
+		return &codewords[(size_t)sub_begin[m] * codebook_size + (size_t)c * subDim(m)];
+	}
+
+	const double* subvector(int k, int m) const
+	{
+		return &centroids[(size_t)k * total_attr + sub_begin[m]];
+	}
+
+	int nearestCodeword(int m, const double* sub) const
+	{
+		int best = 0;
+		double best_dist = INFINITY;
+		for(int c = 0; c < codebook_size; c++)
+		{
+			double dist = squaredDistance(codeword(m, c), sub, subDim(m));
+			if(dist < best_dist)
+			{
+				best_dist = dist;
+				best = c;
+			}
+		}
+		return best;
+	}
+
+	// Small Lloyd run over the K subvectors of subspace m
+	void trainSubspace(int m)
+	{
+		int sub_dim = subDim(m);
+		for(int c = 0; c < codebook_size; c++) // evenly spaced centroids as seeds
+		{
+			const double* seed = subvector((int)((long long)c * K / codebook_size), m);
+			copy(seed, seed + sub_dim, codeword(m, c));
+		}
+
+		vector<double> sums((size_t)codebook_size * sub_dim);
+		vector<int> counts(codebook_size);
+		for(int iter = 0; iter < TRAIN_ITERATIONS; iter++)
+		{
+			fill(sums.begin(), sums.end(), 0.0);
+			fill(counts.begin(), counts.end(), 0);
+			for(int k = 0; k < K; k++)
+			{
+				int c = nearestCodeword(m, subvector(k, m));
+				const double* sub = subvector(k, m);
+				for(int j = 0; j < sub_dim; j++)
+					sums[(size_t)c * sub_dim + j] += sub[j];
+				counts[c]++;
+			}
+			for(int c = 0; c < codebook_size; c++)
+			{
+				if(counts[c] == 0)
+					continue; // keep the old codeword
+				double* cw = codeword(m, c);
+				for(int j = 0; j < sub_dim; j++)
+					cw[j] = sums[(size_t)c * sub_dim + j] / counts[c];
+			}
+		}
+		for(int k = 0; k < K; k++)
+			codes[(size_t)k * M + m] = (uint8_t)nearestCodeword(m, subvector(k, m));
+	}
+
+public:
+	// Per-thread buffers for queries
+	struct Scratch
+	{
+		vector<float> table;                   // M * codebook_size
+		vector<pair<float, int>> candidates;   // max-heap of the rerank_depth best scores
+	};
+
+	CentroidProductQuantizer()
+	{
+		K = total_attr = M = codebook_size = 0;
+		rerank_depth = 8;
+		centroids = nullptr;
+	}
+
+	// Number of subspaces; 0 picks ~8 attributes per subspace
+	void setSubspaces(int M)
+	{
+		this->M = M;
+	}
+
+	void setRerankDepth(int rerank_depth)
+	{
+		this->rerank_depth = max(1, rerank_depth);
+	}
+
+	int getRerankDepth()
+	{
+		return rerank_depth;
+	}
+
+	int getSubspaces()
+	{
+		return M;
+	}
+
+	// Payload bytes of the codebooks and codes (one subspace per attribute at most: K * total_attr codes)
+	static size_t memoryBytes(int K, int total_attr)
+	{
+		return (size_t)CODEBOOK_SIZE * total_attr * sizeof(double) + (size_t)K * total_attr + (total_attr + 1) * sizeof(int);
+	}
+
+	// Retrain the codebooks and re-encode the centroids (subspaces in parallel)
+	void build(const double* centroids, int K, int total_attr)
+	{
+		this->centroids = centroids;
+		this->K = K;
+		this->total_attr = total_attr;
+		if(M <= 0 || M > total_attr)
+			M = max(1, total_attr / 8);
+		codebook_size = min(K, CODEBOOK_SIZE);
+
+		sub_begin.resize(M + 1);
+		for(int m = 0; m <= M; m++)
+			sub_begin[m] = (int)((long long)m * total_attr / M);
+		codewords.resize((size_t)codebook_size * total_attr);
+		codes.resize((size_t)K * M);
+
+		tbb::parallel_for(0, M, 1, [&](int m) {
+			trainSubspace(m);
+		});
+	}
+
+	// Approximate nearest centroid: best exact distance among the rerank_depth best table scores
+	int findNearest(const double* p_vals, Scratch& scratch, double& min_dist) const
+	{
+		scratch.table.resize((size_t)M * codebook_size);
+		for(int m = 0; m < M; m++)
+		{
+			float* row = &scratch.table[(size_t)m * codebook_size];
+			for(int c = 0; c < codebook_size; c++)
+				row[c] = (float)squaredDistance(codeword(m, c), p_vals + sub_begin[m], subDim(m));
+		}
+
+		int depth = min(rerank_depth, K);
+		auto& heap = scratch.candidates;
+		heap.clear();
+		for(int k = 0; k < K; k++)
+		{
+			const uint8_t* code = &codes[(size_t)k * M];
+			float score = 0.0f;
+			for(int m = 0; m < M; m++)
+				score += scratch.table[(size_t)m * codebook_size + code[m]];
+
+			if((int)heap.size() < depth)
+			{
+				heap.push_back(make_pair(score, k));
+				push_heap(heap.begin(), heap.end());
+			}
+			else if(score < heap.front().first)
+			{
+				pop_heap(heap.begin(), heap.end());
+				heap.back() = make_pair(score, k);
+				push_heap(heap.begin(), heap.end());
+			}
+		}
+
+		int id_cluster_center = K;
+		min_dist = INFINITY;
+		for(auto& candidate : heap)
+		{
+			int k = candidate.second;
+			double dist = squaredDistance(&centroids[(size_t)k * total_attr], p_vals, total_attr);
+			if(dist < min_dist || (dist == min_dist && k < id_cluster_center))
+			{
+				min_dist = dist;
+				id_cluster_center = k;
+			}
+		}
+		return id_cluster_center;
+	}
+};
+
+#endif
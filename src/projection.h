@@ -0,0 +1,271 @@
+// Linear maps from total_attr down to reduced_attr dimensions: y = B (x - mean)
+// Used by the reduced-space pre-stage of KMeans::run (Gaussian random projection or PCA).
+
+#ifndef KMEANS_PROJECTION_H
+#define KMEANS_PROJECTION_H
+
+#include <vector>
+#include <random>
+#include <math.h>
+#include <algorithm>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+
+using namespace std;
+
+enum ReductionMethod { REDUCE_RANDOM_PROJECTION, REDUCE_PCA };
+
+class LinearProjection
+{
+private:
+	static const int PCA_OVERSAMPLING = 8;        // directions carried along beyond reduced_attr
+	static const int PCA_SUBSPACE_ITERATIONS = 8; // passes over the points, one covariance product each
+
+	int total_attr, reduced_attr;
+	vector<double> basis; // reduced_attr * total_attr, row r is output dimension r
+	vector<double> mean;  // total_attr (all zeros for random projections)
+
+	// Gram-Schmidt on the first count rows (total_attr wide)
+	void orthonormalize(vector<double>& rows, int count)
+	{
+		for(int r = 0; r < count; r++)
+		{
+			double* row = &rows[(size_t)r * total_attr];
+			for(int q = 0; q < r; q++)
+			{
+				const double* prev = &rows[(size_t)q * total_attr];
+				double dot = 0.0;
+				for(int j = 0; j < total_attr; j++)
+					dot += row[j] * prev[j];
+				for(int j = 0; j < total_attr; j++)
+					row[j] -= dot * prev[j];
+			}
+			double norm = 0.0;
+			for(int j = 0; j < total_attr; j++)
+				norm += row[j] * row[j];
+			norm = sqrt(norm);
+			if(norm > 0.0)
+				for(int j = 0; j < total_attr; j++)
+					row[j] /= norm;
+		}
+	}
+
+	// out = block * C for the count rows of block, C the weighted covariance of the points. C itself is never
+	// formed: every point adds w (x - mean) ((x - mean) . row) to each output row, in count * total_attr thread
+	// local accumulators, so one product is one pass over the points.
+	template <class PointVector>
+	void covarianceProduct(PointVector& points, int total_points, double total_weight, const vector<double>& block, int count,
+		vector<double>& out)
+	{
+		tbb::enumerable_thread_specific<vector<double>> thread_local_out(
+			[&]() { return vector<double>((size_t)count * total_attr, 0.0); }
+		);
+		tbb::parallel_for(tbb::blocked_range<int>(0, total_points), [&](const tbb::blocked_range<int>& r) {
+			auto& local_out = thread_local_out.local();
+			vector<double> centered(total_attr);
+			for(int i = r.begin(); i < r.end(); i++)
+			{
+				double* p_vals = points[i].getValues().data();
+				double weight = points[i].getWeight();
+				for(int j = 0; j < total_attr; j++)
+					centered[j] = p_vals[j] - mean[j];
+				for(int c = 0; c < count; c++)
+				{
+					const double* row = &block[(size_t)c * total_attr];
+					double dot = 0.0;
+					for(int j = 0; j < total_attr; j++)
+						dot += centered[j] * row[j];
+					dot *= weight;
+					double* acc = &local_out[(size_t)c * total_attr];
+					for(int j = 0; j < total_attr; j++)
+						acc[j] += dot * centered[j];
+				}
+			}
+		});
+		out.assign((size_t)count * total_attr, 0.0);
+		for(const auto& local_out : thread_local_out)
+			for(size_t j = 0; j < out.size(); j++)
+				out[j] += local_out[j];
+		for(auto& value : out)
+			value /= total_weight;
+	}
+
+	// Eigen decomposition of the symmetric n x n matrix a by cyclic Jacobi rotations: a ends up diagonal
+	// (the eigenvalues), the columns of vectors are the eigenvectors. n is small (reduced_attr + PCA_OVERSAMPLING).
+	static void symmetricEigen(vector<double>& a, int n, vector<double>& vectors)
+	{
+		vectors.assign((size_t)n * n, 0.0);
+		for(int i = 0; i < n; i++)
+			vectors[(size_t)i * n + i] = 1.0;
+		for(int sweep = 0; sweep < 64; sweep++)
+		{
+			double off = 0.0, total = 0.0;
+			for(int p = 0; p < n; p++)
+				for(int q = 0; q < n; q++)
+				{
+					total += a[(size_t)p * n + q] * a[(size_t)p * n + q];
+					if(p != q)
+						off += a[(size_t)p * n + q] * a[(size_t)p * n + q];
+				}
+			if(off <= 1e-24 * total)
+				break;
+			for(int p = 0; p < n; p++)
+				for(int q = p + 1; q < n; q++)
+				{
+					double apq = a[(size_t)p * n + q];
+					if(apq == 0.0)
+						continue;
+					double theta = (a[(size_t)q * n + q] - a[(size_t)p * n + p]) / (2.0 * apq);
+					double t = (theta >= 0.0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+					double c = 1.0 / sqrt(t * t + 1.0), s = t * c;
+					for(int k = 0; k < n; k++) // columns p, q
+					{
+						double akp = a[(size_t)k * n + p], akq = a[(size_t)k * n + q];
+						a[(size_t)k * n + p] = c * akp - s * akq;
+						a[(size_t)k * n + q] = s * akp + c * akq;
+					}
+					for(int k = 0; k < n; k++) // rows p, q
+					{
+						double apk = a[(size_t)p * n + k], aqk = a[(size_t)q * n + k];
+						a[(size_t)p * n + k] = c * apk - s * aqk;
+						a[(size_t)q * n + k] = s * apk + c * aqk;
+					}
+					for(int k = 0; k < n; k++)
+					{
+						double vkp = vectors[(size_t)k * n + p], vkq = vectors[(size_t)k * n + q];
+						vectors[(size_t)k * n + p] = c * vkp - s * vkq;
+						vectors[(size_t)k * n + q] = s * vkp + c * vkq;
+					}
+				}
+		}
+	}
+
+public:
+	LinearProjection()
+	{
+		total_attr = reduced_attr = 0;
+	}
+
+	int getReducedAttr()
+	{
+		return reduced_attr;
+	}
+
+	// Entries ~ N(0, 1 / reduced_attr) so distances are preserved in expectation (Johnson-Lindenstrauss)
+	void fitRandom(int total_attr, int reduced_attr, unsigned int seed)
+	{
+		this->total_attr = total_attr;
+		this->reduced_attr = reduced_attr;
+		mean.assign(total_attr, 0.0);
+		basis.resize((size_t)reduced_attr * total_attr);
+
+		mt19937 gen(seed);
+		normal_distribution<double> gauss(0.0, 1.0 / sqrt((double)reduced_attr));
+		for(auto& b : basis)
+			b = gauss(gen);
+	}
+
+	// Top reduced_attr principal directions of the points, each counted getWeight() times (collapsed duplicates,
+	// coreset points) in the mean and the covariance. Randomized subspace iteration: reduced_attr + PCA_OVERSAMPLING
+	// random directions are multiplied by the covariance PCA_SUBSPACE_ITERATIONS times (covarianceProduct, memory
+	// O(threads * directions * total_attr) instead of a total_attr^2 covariance), then Rayleigh-Ritz on that
+	// subspace sorts out the top reduced_attr.
+	template <class PointVector>
+	void fitPCA(PointVector& points, int total_points, int total_attr, int reduced_attr, unsigned int seed)
+	{
+		this->total_attr = total_attr;
+		this->reduced_attr = reduced_attr;
+
+		tbb::enumerable_thread_specific<vector<double>> thread_local_sums(
+			[&]() { return vector<double>(total_attr + 1, 0.0); } // weighted sums, then the total weight
+		);
+		tbb::parallel_for(0, total_points, 1, [&](int i) {
+			auto& local_sums = thread_local_sums.local();
+			double* p_vals = points[i].getValues().data();
+			double weight = points[i].getWeight();
+			for(int j = 0; j < total_attr; j++)
+				local_sums[j] += weight * p_vals[j];
+			local_sums[total_attr] += weight;
+		});
+		vector<double> sums(total_attr + 1, 0.0);
+		for(const auto& local_sums : thread_local_sums)
+			for(int j = 0; j <= total_attr; j++)
+				sums[j] += local_sums[j];
+		double total_weight = sums[total_attr];
+		mean.assign(total_attr, 0.0);
+		for(int j = 0; j < total_attr; j++)
+			mean[j] = sums[j] / total_weight;
+
+		int block_rows = min(total_attr, reduced_attr + PCA_OVERSAMPLING);
+		vector<double> block((size_t)block_rows * total_attr), product;
+		mt19937 gen(seed);
+		normal_distribution<double> gauss(0.0, 1.0);
+		for(auto& b : block)
+			b = gauss(gen);
+		orthonormalize(block, block_rows);
+		for(int it = 0; it < PCA_SUBSPACE_ITERATIONS; it++)
+		{
+			covarianceProduct(points, total_points, total_weight, block, block_rows, product);
+			block.swap(product);
+			orthonormalize(block, block_rows);
+		}
+
+		// Rayleigh-Ritz: the eigenvectors of block C block^T rotate the block onto the principal directions
+		covarianceProduct(points, total_points, total_weight, block, block_rows, product);
+		vector<double> small((size_t)block_rows * block_rows), vectors;
+		for(int a = 0; a < block_rows; a++)
+			for(int b = 0; b < block_rows; b++)
+			{
+				double dot = 0.0;
+				for(int j = 0; j < total_attr; j++)
+					dot += product[(size_t)a * total_attr + j] * block[(size_t)b * total_attr + j];
+				small[(size_t)a * block_rows + b] = dot;
+			}
+		for(int a = 0; a < block_rows; a++) // symmetric up to rounding
+			for(int b = 0; b < a; b++)
+				small[(size_t)a * block_rows + b] = small[(size_t)b * block_rows + a] =
+					0.5 * (small[(size_t)a * block_rows + b] + small[(size_t)b * block_rows + a]);
+		symmetricEigen(small, block_rows, vectors);
+
+		vector<int> order(block_rows);
+		for(int k = 0; k < block_rows; k++)
+			order[k] = k;
+		sort(order.begin(), order.end(), [&](int x, int y) {
+			return small[(size_t)x * block_rows + x] > small[(size_t)y * block_rows + y];
+		});
+		basis.assign((size_t)reduced_attr * total_attr, 0.0);
+		for(int r = 0; r < reduced_attr; r++)
+		{
+			double* row = &basis[(size_t)r * total_attr];
+			for(int m = 0; m < block_rows; m++)
+			{
+				double coef = vectors[(size_t)m * block_rows + order[r]];
+				const double* q_row = &block[(size_t)m * total_attr];
+				for(int j = 0; j < total_attr; j++)
+					row[j] += coef * q_row[j];
+			}
+		}
+	}
+
+	// Project every point, in parallel
+	template <class PointVector, class ReducedPointVector>
+	void apply(PointVector& points, int total_points, ReducedPointVector& reduced)
+	{
+		tbb::parallel_for(0, total_points, 1, [&](int i) {
+			double* p_vals = points[i].getValues().data();
+			double* out = reduced[i].getValues().data();
+			for(int r = 0; r < reduced_attr; r++)
+			{
+				const double* row = &basis[(size_t)r * total_attr];
+				double sum = 0.0;
+				for(int j = 0; j < total_attr; j++)
+					sum += row[j] * (p_vals[j] - mean[j]);
+				out[r] = sum;
+			}
+		});
+	}
+};
+
+#endif
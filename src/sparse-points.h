@@ -0,0 +1,64 @@
+// Sparse points in CSR form, for inputs that are mostly zeros (e.g. bag-of-words features).
+// Input lines are "index:value index:value ..." with 0-based attribute indexes; missing attributes are 0 and
+// an empty line is the all-zero point. Tokens without ':' (e.g. a trailing name) are ignored.
+
+#ifndef KMEANS_SPARSE_POINTS_H
+#define KMEANS_SPARSE_POINTS_H
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+using namespace std;
+
+struct SparseMatrix
+{
+	int total_points = 0;
+	int total_attr = 0;
+	vector<int64_t> row_start;   // total_points + 1 offsets into attr_index / values
+	vector<int> attr_index;
+	vector<double> values;
+
+	int64_t nonZeros() const
+	{
+		return row_start.empty() ? 0 : row_start.back();
+	}
+};
+
+// Append the index:value pairs of one line; false on a malformed pair or an index outside [0, total_attr)
+inline bool parseSparseLine(const string& line, int total_attr, vector<pair<int, double>>& entries)
+{
+	entries.clear();
+	const char* cursor = line.c_str();
+	while(*cursor)
+	{
+		while(isspace((unsigned char)*cursor))
+			cursor++;
+		if(!*cursor)
+			break;
+		const char* token = cursor;
+		while(*cursor && !isspace((unsigned char)*cursor) && *cursor != ':')
+			cursor++;
+		if(*cursor != ':')
+		{
+			while(*cursor && !isspace((unsigned char)*cursor))
+				cursor++;
+			continue; // not a pair
+		}
+		char* end;
+		long index = strtol(token, &end, 10);
+		if(end != cursor || index < 0 || index >= total_attr)
+			return false;
+		double value = strtod(cursor + 1, &end);
+		if(end == cursor + 1)
+			return false;
+		cursor = end;
+		if(value != 0.0)
+			entries.push_back(make_pair((int)index, value));
+	}
+	return true;
+}
+
+#endif